@@ -0,0 +1,61 @@
+#ifndef  __DECODE_STAGE_H__
+#define  __DECODE_STAGE_H__
+
+#include  <atomic>
+#include  <opencv2/opencv.hpp>
+#include  "SPSCQueue.h"
+
+
+/*
+ * the decode stage the app and the batch tool share: one thread per input
+ * reads its frames and hands them to the processing stage through a queue.
+ * */
+typedef SPSCQueue<cv::Mat> FrameQueue;
+
+enum InputKind
+{
+	INPUT_VIDEO,
+	INPUT_MASK,
+	INPUT_BACKGROUND
+};
+
+/**
+ * @brief decodeLoop: decode stage of one input, ends the stream with an empty frame
+ *
+ * @param cap: the input
+ * @param kind: how to prepare the frames of this input
+ * @param maxFrames: stop after this many frames, <= 0 for the whole input
+ * @param queue: queue to the processing stage
+ * @param stop: raised when the pipeline shuts down
+ */
+inline void decodeLoop(cv::VideoCapture *cap, InputKind kind, int maxFrames, FrameQueue *queue,
+		std::atomic<bool> *stop)
+{
+	int n;
+
+	for( n = 0 ; maxFrames <= 0 || n < maxFrames ; ++n )
+	{
+		/* a new matrix each time, the last one may still be in the queue */
+		cv::Mat frame, tmp;
+		*cap >> tmp;
+		if( !tmp.data )
+			break;
+		if( kind == INPUT_MASK )
+		{
+			/* image sequences may already be gray */
+			if( tmp.channels() == 3 )
+				cv::cvtColor(tmp, frame, CV_BGR2GRAY);
+			else
+				frame = tmp;
+			cv::threshold(frame, frame, 128, 255, CV_THRESH_BINARY);
+		}
+		else
+			frame = tmp;
+		if( !queue->push(frame, *stop) )
+			return;
+	}
+	queue->push(cv::Mat(), *stop);
+}
+
+
+#endif  /*__DECODE_STAGE_H__*/
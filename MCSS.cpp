@@ -8,476 +8,1366 @@
  *
  * */
 
+#include  <algorithm>
+#include  <map>
+#include  <mutex>
 #include  "MCSS.h"
-#define  debug
+#include  "MCSSKernels.h"
+#include  "MCSSDiagnostics.h"
 
-static Point stack[STACK_SIZE];
+/* margin around the object boxes, wide enough for the 5x5 erosion and the 3x3 closing */
+#define  REGION_MARGIN	3
+/* 
+ * rows of a band of the background update, the sums of each band are
+ * added in order, so a fixed size keeps them independent of the threads
+ * */
+#define  BACKGROUND_BAND_ROWS	16
+/* 
+ * pixels of object boxes a task of the per object passes aims at, smaller
+ * objects are batched and larger ones split into bands of rows
+ * */
+#define  OBJECT_TASK_PIXELS	16384
+/* marks of a boundary pixel of the coarse result in pyramid mode */
+#define  PYR_BOUNDARY	1
+#define  PYR_NEAR_SHADOW	2
+/* fractional bits of alpha, and of tao and lambda_low, in the integer only mode */
+#define  ALPHA_FIXED_SHIFT	32
+#define  RATIO_FIXED_SHIFT	16
+/* distance code of the edge noise correction when no labeled pixel was met, +2 can't overflow */
+#define  FRINGE_FAR	(INT_MAX/2)
+/* 
+ * capacity the per frame tables get on the first frame, of the
+ * provisional labels, of the objects and of the lgcs. They grow past it
+ * when a frame needs more and never shrink, so after the first frames
+ * a frame allocates nothing.
+ * */
+#define  RESERVED_LABELS	4096
+#define  RESERVED_OBJECTS	256
+#define  RESERVED_LGCS	4096
+/* the same for the node components and the lgcs of the table of each batch */
+#define  RESERVED_BATCH_LGCS	64
+
+/* the statistics code, gone with -DMCSS_NO_STATS */
+#ifndef MCSS_NO_STATS
+#define  STATS(...)	__VA_ARGS__
+#else
+#define  STATS(...)
+#endif
+
+/**
+ * @brief lap: time of a stage
+ *
+ * @param tick: tick count at the start of the stage, moved to now
+ *
+ * @return: milliseconds since tick
+ */
+static inline double lap(int64 &tick)
+{
+	int64 now = getTickCount();
+	double ms = (now-tick)*1000.0/getTickFrequency();
+
+	tick = now;
+	return ms;
+}
 
 /**
- * @brief getNearestVal: check the pixel, in narrow bright fringe, if it belongs to shadow or foreground
- *						 ( F. Edge Noise Correction )
+ * @brief findRoot: find the representative label of an equivalence class
  *
- * @param mat: a matrix represent background(0), foreground(255) and shadow(127)
- * @param pos: the position of this pixel
+ * @param parent: the equivalence table, parent[i] <= i
+ * @param label: the label you want to look up
  *
- * @return: return 127 if it belongs to shadow or 255 to foreground
+ * @return: the smallest label in the same class
  */
-int MCSS::getNearestVal(Point pos)
+static inline int findRoot(int *parent, int label)
 {
-	int a = 5, i1, i2, j1, j2, i, j, m = 0, n = 0;
-	assert(dst.type() == CV_8UC1);
-	while(1)
+	while( parent[label] != label )
 	{
-		i1 = MAX(0, pos.x-a);
-		i2 = MIN(dst.rows-1, i+a);
-		j1 = MAX(0, pos.y-a);
-		j2 = MIN(dst.cols-1, j+a);
-		for( i = i1 ; i <= i2 ; ++i )
-		{
-			for( j = j1 ; j <= j2 ; ++j )
-			{
-				if( dst.at<uchar>(i, j) == 255 )
-					++n;
-				if( dst.at<uchar>(i, j) == 127 )
-					++m;
-			}
-		}
+		/* path halving */
+		parent[label] = parent[parent[label]];
+		label = parent[label];
+	}
+	return label;
+}
 
-		if( m == 0 && n == 0 )
-			++a;
-		if( m>0 && m>=n )
-			return 127;
-		if( n>0 && n>m )
-			return 255;
+/**
+ * @brief unionRoot: merge the equivalence classes of two labels
+ *
+ * @param parent: the equivalence table
+ * @param a: one label
+ * @param b: another label
+ *
+ * @return: the representative label of the merged class
+ */
+static inline int unionRoot(int *parent, int a, int b)
+{
+	a = findRoot(parent, a);
+	b = findRoot(parent, b);
+	/* always keep the smaller label as root, so the root is the first one met in raster order */
+	if( a < b )
+	{
+		parent[b] = a;
+		return a;
 	}
+	parent[a] = b;
+	return b;
 }
 
 /**
- * @brief cleanRegionU8: use DFS to clean a region with val1 start from point p
+ * @brief labelObjects: label each 8-connected foreground object with a unique index
+ *						using a two-pass union-find scan
  *
- * @param mat: the matrix you want to clean
- * @param p: the position you want to start from
- * @param val1: the value you want to clean
- * @param val2: the new value you want to set
+ * @param mask: the binary image of foreground
+ * @param objLabel: the matrix to store each object's label, must be zero on entry,
+ *					only the boxes of the accepted objects are written
+ * @param objArea: area of each object we accept
+ * @param objBox: bounding box of each object we accept
+ * @param minArea: objects smaller than this are rejected and labeled 0
+ * @param scratch: workspace of the model, blobBox gets the box of every
+ *				   connected region of the mask, rejected or not
  *
- * @return: number of points we cleaned
+ * @return: number of objects
  */
-static int cleanRegionU8(Mat mat, Point p, int val1, int val2 = 0)
+static int labelObjects(Mat mask,
+		Mat objLabel,
+		vector<int> &objArea,
+		vector<Rect> &objBox,
+		int minArea,
+		MCSS_Scratch &scratch)
 {
-	CV_Assert(val1 != val2);
-	CV_Assert(mat.type() == CV_8UC1);
-	int topIndex = 0, num = 0;
-	Mat visited = Mat::zeros(mat.size(), CV_8UC1);
+	int i, j, k, objNum = 0;
+	Mat &provisional = scratch.labels;
+	vector<int> &parent = scratch.parent, &area = scratch.area, &remap = scratch.remap;
+	vector<Vec4i> &box = scratch.box;
 
-	if( mat.at<uchar>(p.x, p.y) != val1 )
-		return 0;
+	CV_Assert(mask.type() == CV_8UC1);
+	CV_Assert(objLabel.type() == CV_32SC1);
+	CV_Assert(provisional.type() == CV_32SC1 && provisional.size() == mask.size());
+	/* label 0 is the background */
+	parent.assign(1, 0);
+	area.assign(1, 0);
+	box.assign(1, Vec4i(0, 0, 0, 0));
+	scratch.blobBox.clear();
 
-	visited.at<uchar>(p.x, p.y) = 255;
-	mat.at<uchar>(p.x, p.y) = val2;
-	stack[topIndex++] = p;
-	while( topIndex )
+	/* first pass: provisional labels and their equivalences */
+	for( i = 0 ; i < mask.rows ; ++i )
 	{
-		Point p1 = stack[topIndex-1];
-		visited.at<uchar>(p1.x, p1.y) = 255;
-		mat.at<uchar>(p1.x, p1.y) = val2;
-		++num;
-		if( (p1.x>0) && (mat.at<uchar>(p1.x-1, p1.y)==val1) && !visited.at<uchar>(p1.x-1, p1.y) )
+		const uchar *m = mask.ptr<uchar>(i);
+		int *cur = provisional.ptr<int>(i);
+		const int *up = i > 0 ? provisional.ptr<int>(i-1) : NULL;
+		for( j = 0 ; j < mask.cols ; ++j )
 		{
-			stack[topIndex++] = Point(p1.x-1, p1.y);
-			continue;
-		}
-		else if( (p1.y>0) && (mat.at<uchar>(p1.x, p1.y-1)==val1) && !visited.at<uchar>(p1.x, p1.y-1) )
-		{
-			stack[topIndex++] = Point(p1.x, p1.y-1);
-			continue;
+			int l = 0, ul, u, ur, lt;
+			if( m[j] == 0 )
+			{
+				cur[j] = 0;
+				continue;
+			}
+			u = up ? up[j] : 0;
+			ul = (up && j > 0) ? up[j-1] : 0;
+			ur = (up && j < mask.cols-1) ? up[j+1] : 0;
+			lt = j > 0 ? cur[j-1] : 0;
+			/* 
+			 * the upper pixel touches all the other scanned neighbours,
+			 * and so does the upper-left one with the left one, only the
+			 * upper-right one may join two different classes
+			 * */
+			if( u )
+				l = u;
+			else if( ur )
+			{
+				l = ur;
+				if( lt )
+					l = unionRoot(&parent[0], ur, lt);
+				else if( ul )
+					l = unionRoot(&parent[0], ur, ul);
+			}
+			else if( ul )
+				l = ul;
+			else if( lt )
+				l = lt;
+			else
+			{
+				l = parent.size();
+				parent.push_back(l);
+				area.push_back(0);
+				/* x0, y0, x1, y1 */
+				box.push_back(Vec4i(j, i, j, i));
+			}
+			cur[j] = l;
+			++area[l];
+			Vec4i &b = box[l];
+			b[0] = MIN(b[0], j);
+			b[2] = MAX(b[2], j);
+			b[3] = i;
 		}
-		else if( (p1.x<mat.rows-1) && (mat.at<uchar>(p1.x+1, p1.y)==val1) && !visited.at<uchar>(p1.x+1, p1.y) )
+	}
+
+	/* 
+	 * resolve the equivalences, a root is always smaller than its children,
+	 * so visiting labels in increasing order visits objects in raster order
+	 * */
+	for( i = 1 ; i < (int)parent.size() ; ++i )
+	{
+		if( parent[i] != i )
 		{
-			stack[topIndex++] = Point(p1.x+1, p1.y);
-			continue;
+			parent[i] = parent[parent[i]];
+			area[parent[i]] += area[i];
+			Vec4i &b = box[parent[i]];
+			b[0] = MIN(b[0], box[i][0]);
+			b[1] = MIN(b[1], box[i][1]);
+			b[2] = MAX(b[2], box[i][2]);
+			b[3] = MAX(b[3], box[i][3]);
 		}
-		else if( (p1.y<mat.cols-1) && (mat.at<uchar>(p1.x, p1.y+1)==val1) && !visited.at<uchar>(p1.x, p1.y+1) )
+	}
+	remap.assign(parent.size(), 0);
+	for( i = 1 ; i < (int)parent.size() ; ++i )
+	{
+		if( parent[i] != i )
 		{
-			stack[topIndex++] = Point(p1.x, p1.y+1);
+			remap[i] = remap[parent[i]];
 			continue;
 		}
-		else if( (p1.x>0 && p1.y>0) && (mat.at<uchar>(p1.x-1, p1.y-1)==val1) && !visited.at<uchar>(p1.x-1, p1.y-1) )
-		{
-			stack[topIndex++] = Point(p1.x-1, p1.y-1);
+		Rect r(box[i][0], box[i][1], box[i][2]-box[i][0]+1, box[i][3]-box[i][1]+1);
+		scratch.blobBox.push_back(r);
+		/* eliminate small regions */
+		if( area[i] < minArea )
 			continue;
-		}
-		else if( (p1.x>0 && p1.y<mat.cols-1) && (mat.at<uchar>(p1.x-1, p1.y+1)==val1) && !visited.at<uchar>(p1.x-1, p1.y+1) )
+		remap[i] = ++objNum;
+		objArea.push_back(area[i]);
+		objBox.push_back(r);
+	}
+
+	/* second pass: write the final labels inside the boxes, the rest stays 0 */
+	for( k = 0 ; k < objNum ; ++k )
+	{
+		const Rect &r = objBox[k];
+		for( i = r.y ; i < r.y+r.height ; ++i )
 		{
-			stack[topIndex++] = Point(p1.x-1, p1.y+1);
-			continue;
+			const int *cur = provisional.ptr<int>(i);
+			int *label = objLabel.ptr<int>(i);
+			for( j = r.x ; j < r.x+r.width ; ++j )
+				label[j] = remap[cur[j]];
 		}
-		else if( (p1.x<mat.rows-1 && p1.y>0) && (mat.at<uchar>(p1.x+1, p1.y-1)==val1) && !visited.at<uchar>(p1.x+1, p1.y-1) )
+	}
+	return objNum;
+}
+
+static bool regionLess(const Rect &a, const Rect &b)
+{
+	return a.x < b.x;
+}
+
+/**
+ * @brief buildRegions: grow the boxes by a margin and merge the overlapping ones
+ *
+ * Every pass after the object detection runs on these regions only. They
+ * don't overlap, so walking the regions crossing each row from left to
+ * right visits their pixels in raster order, and the margin keeps the
+ * neighbourhood of each object pixel inside its region.
+ *
+ * @param boxes: bounding boxes of the objects
+ * @param frameSize: size of the frame
+ * @param scratch: workspace of the model, gets regions (sorted by x) and
+ *				   the regions crossing row i in rowRegions[rowStart[i] .. rowStart[i+1])
+ */
+static void buildRegions(const vector<Rect> &boxes, Size frameSize, MCSS_Scratch &scratch)
+{
+	vector<Rect> &regions = scratch.regions;
+	vector<int> &rowStart = scratch.rowStart, &rowRegions = scratch.rowRegions;
+	Rect frame(0, 0, frameSize.width, frameSize.height);
+	int i, j, k, n;
+	bool merged = true;
+
+	regions.clear();
+	for( k = 0 ; k < (int)boxes.size() ; ++k )
+	{
+		const Rect &b = boxes[k];
+		regions.push_back(Rect(b.x-REGION_MARGIN, b.y-REGION_MARGIN,
+					b.width+2*REGION_MARGIN, b.height+2*REGION_MARGIN) & frame);
+	}
+	while( merged )
+	{
+		merged = false;
+		sort(regions.begin(), regions.end(), regionLess);
+		n = regions.size();
+		for( i = 0 ; i < n ; ++i )
 		{
-			stack[topIndex++] = Point(p1.x+1, p1.y-1);
-			continue;
+			if( regions[i].area() == 0 )
+				continue;
+			/* sorted by x, so only the next few can overlap */
+			for( j = i+1 ; j < n && regions[j].x < regions[i].x+regions[i].width ; ++j )
+			{
+				if( (regions[i] & regions[j]).area() == 0 )
+					continue;
+				regions[i] |= regions[j];
+				regions[j] = Rect();
+				merged = true;
+				/* the grown region may now reach the ones skipped before */
+				j = i;
+			}
 		}
-		else if( (p1.x<mat.rows-1 && p1.y<mat.cols-1) && (mat.at<uchar>(p1.x+1, p1.y+1)==val1) && !visited.at<uchar>(p1.x+1, p1.y+1) )
+		for( i = k = 0 ; i < n ; ++i )
 		{
-			stack[topIndex++] = Point(p1.x+1, p1.y+1);
-			continue;
+			if( regions[i].area() != 0 )
+				regions[k++] = regions[i];
 		}
-		else
-			--topIndex;
+		regions.resize(k);
+	}
+
+	/* bucket the regions by row, keeping them sorted by x */
+	rowStart.assign(frameSize.height+1, 0);
+	for( k = 0 ; k < (int)regions.size() ; ++k )
+	{
+		for( i = regions[k].y ; i < regions[k].y+regions[k].height ; ++i )
+			++rowStart[i+1];
+	}
+	for( i = 0 ; i < frameSize.height ; ++i )
+		rowStart[i+1] += rowStart[i];
+	rowRegions.resize(rowStart[frameSize.height]);
+	for( k = 0 ; k < (int)regions.size() ; ++k )
+	{
+		for( i = regions[k].y ; i < regions[k].y+regions[k].height ; ++i )
+			rowRegions[rowStart[i]++] = k;
 	}
-	return (num+1)/2;
+	/* rowStart[i] has moved to the start of row i+1 */
+	for( i = frameSize.height ; i > 0 ; --i )
+		rowStart[i] = rowStart[i-1];
+	rowStart[0] = 0;
+}
+
+/**
+ * @brief clearRegions: zero a matrix inside the regions
+ *
+ * @param mat: the matrix
+ * @param regions: the regions
+ */
+static void clearRegions(Mat mat, const vector<Rect> &regions)
+{
+	for( size_t k = 0 ; k < regions.size() ; ++k )
+		mat(regions[k]).setTo(Scalar::all(0));
 }
 
 /**
- * @brief cleanRegionU16: use DFS to clean a region with val1 start from point p
+ * @brief growCapacity: make room for n elements, at least doubling the capacity
  *
- * @param mat: the matrix you want to clean
- * @param p: the position you want to start from
- * @param val1: the value you want to clean
- * @param val2: the new value you want to set
+ * A resize after a clear allocates just the new size, so a table whose
+ * size creeps up frame after frame would allocate on most of them. This
+ * makes it as rare as with push_back.
  *
- * @return: number of points we cleaned
+ * @param v: the table
+ * @param n: elements it is about to hold
  */
-static int cleanRegionU16(Mat mat, Point p, int val1, int val2 = 0)
+template<typename T>
+static inline void growCapacity(vector<T> &v, size_t n)
 {
-	CV_Assert(val1 != val2);
-	CV_Assert(mat.type() == CV_16UC1);
-	int topIndex = 0, num = 0;
-	Mat visited = Mat::zeros(mat.size(), CV_8UC1);
+	if( n > v.capacity() )
+		v.reserve(MAX(n, 2*v.capacity()));
+}
 
-	if( mat.at<ushort>(p.x, p.y) != val1 )
-		return 0;
+/**
+ * @brief morphRegion: dilate or erode a matrix inside a region with a square window
+ *
+ * The window is separable, the max (min) of the row neighbours goes to
+ * tmp, then the max (min) of its column neighbours to dst. The pixels out
+ * of the region are left out like those out of the frame, which the
+ * margin of the regions makes the same as running on the whole frame.
+ * Unlike dilate and erode, it allocates nothing.
+ *
+ * @param src: the input
+ * @param dst: the output, may be src
+ * @param tmp: workspace of the size and type of src
+ * @param r: the region
+ * @param radius: the window is 2*radius+1 pixels wide
+ * @param isMax: dilate if true, else erode
+ */
+template<typename T>
+static void morphRegion(const Mat &src, Mat &dst, Mat &tmp, const Rect &r, int radius, bool isMax)
+{
+	int cn = src.channels(), x0 = r.x*cn, x1 = (r.x+r.width)*cn;
+	int i, j, k, c, y;
 
-	visited.at<uchar>(p.x, p.y) = 255;
-	mat.at<ushort>(p.x, p.y) = val2;
-	stack[topIndex++] = p;
-	while( topIndex )
+	for( i = r.y ; i < r.y+r.height ; ++i )
 	{
-		Point p1 = stack[topIndex-1];
-		visited.at<uchar>(p1.x, p1.y) = 255;
-		mat.at<ushort>(p1.x, p1.y) = val2;
-		++num;
-		if( (p1.x>0) && (mat.at<ushort>(p1.x-1, p1.y)==val1) && !visited.at<uchar>(p1.x-1, p1.y) )
-		{
-			stack[topIndex++] = Point(p1.x-1, p1.y);
-			continue;
-		}
-		else if( (p1.y>0) && (mat.at<ushort>(p1.x, p1.y-1)==val1) && !visited.at<uchar>(p1.x, p1.y-1) )
+		const T *s = src.ptr<T>(i);
+		T *t = tmp.ptr<T>(i);
+		for( j = r.x ; j < r.x+r.width ; ++j )
 		{
-			stack[topIndex++] = Point(p1.x, p1.y-1);
-			continue;
-		}
-		else if( (p1.x<mat.rows-1) && (mat.at<ushort>(p1.x+1, p1.y)==val1) && !visited.at<uchar>(p1.x+1, p1.y) )
-		{
-			stack[topIndex++] = Point(p1.x+1, p1.y);
-			continue;
+			int k0 = MAX(j-radius, r.x)*cn, k1 = MIN(j+radius, r.x+r.width-1)*cn;
+			for( c = 0 ; c < cn ; ++c )
+			{
+				T best = s[k0+c];
+				for( k = k0+cn+c ; k <= k1+c ; k += cn )
+					best = isMax ? MAX(best, s[k]) : MIN(best, s[k]);
+				t[j*cn+c] = best;
+			}
 		}
-		else if( (p1.y<mat.cols-1) && (mat.at<ushort>(p1.x, p1.y+1)==val1) && !visited.at<uchar>(p1.x, p1.y+1) )
+	}
+	for( i = r.y ; i < r.y+r.height ; ++i )
+	{
+		int y0 = MAX(i-radius, r.y), y1 = MIN(i+radius, r.y+r.height-1);
+		T *d = dst.ptr<T>(i);
+		memcpy(d+x0, tmp.ptr<T>(y0)+x0, (x1-x0)*sizeof(T));
+		for( y = y0+1 ; y <= y1 ; ++y )
 		{
-			stack[topIndex++] = Point(p1.x, p1.y+1);
-			continue;
+			const T *t = tmp.ptr<T>(y);
+			for( j = x0 ; j < x1 ; ++j )
+				d[j] = isMax ? MAX(d[j], t[j]) : MIN(d[j], t[j]);
 		}
-		else if( (p1.x>0 && p1.y>0) && (mat.at<ushort>(p1.x-1, p1.y-1)==val1) && !visited.at<uchar>(p1.x-1, p1.y-1) )
+	}
+}
+
+/**
+ * @brief updateBackgroundRow: backgroundRow on the float or on the fixed point statistics
+ */
+static inline void updateBackgroundRow(const uchar *current, const uchar *objMask, uchar *cont,
+		float *mean, float *std, int width)
+{
+	backgroundRow(current, objMask, cont, mean, std, width, HISTORY);
+}
+
+static inline void updateBackgroundRow(const uchar *current, const uchar *objMask, uchar *cont,
+		short *mean, short *std, int width)
+{
+	backgroundRowFixed(current, objMask, cont, mean, std, width, HISTORY, BG_FIXED_SHIFT);
+}
+
+/* 
+ * update the background statistics of bands of rows, and in the same sweep
+ * sum the mean and STD of each object's pixels over the regions of the band
+ * (Part IV. EXPERIMENTAL RESULTS, A. Parameter Analysis, (1)Minimum gradient threshold).
+ * Each band adds to its own sums of the objects crossing it, which are
+ * zero on entry. The statistics are left as they are if the built-in
+ * background model has already updated them. T is float, summed in
+ * double, or the fixed point of the integer only mode, summed exactly.
+ * */
+template<typename T, typename S>
+class BackgroundUpdater : public ParallelLoopBody
+{
+	public:
+		BackgroundUpdater(const Mat &_current, const Mat &_objLabel, Mat &_cont, Mat &_mean, Mat &_STD,
+				bool _update, const vector<Rect> &_objBox, S *_sums, const MCSS_Scratch &_scratch)
+			: current(_current), objLabel(_objLabel), cont(_cont), mean(_mean), STD(_STD),
+			update(_update), objBox(_objBox), sums(_sums), scratch(_scratch)
 		{
-			stack[topIndex++] = Point(p1.x-1, p1.y-1);
-			continue;
 		}
-		else if( (p1.x>0 && p1.y<mat.cols-1) && (mat.at<ushort>(p1.x-1, p1.y+1)==val1) && !visited.at<uchar>(p1.x-1, p1.y+1) )
+
+		void operator()(const Range &range) const
 		{
-			stack[topIndex++] = Point(p1.x-1, p1.y+1);
-			continue;
+			const int *sumStart = &scratch.bgSumStart[0];
+			for( int band = range.start ; band < range.end ; ++band )
+			{
+				int rowEnd = MIN((band+1)*BACKGROUND_BAND_ROWS, objLabel.rows);
+				for( int i = band*BACKGROUND_BAND_ROWS ; i < rowEnd ; ++i )
+				{
+					const int *obj = objLabel.ptr<int>(i);
+					const T *m = mean.ptr<T>(i), *sd = STD.ptr<T>(i);
+					/* only the background pixels are updated, only the object pixels are summed */
+					if( update )
+						updateBackgroundRow(current.ptr<uchar>(i), scratch.objMask.ptr<uchar>(i),
+								cont.ptr<uchar>(i), mean.ptr<T>(i), STD.ptr<T>(i), objLabel.cols);
+					for( int k = scratch.rowStart[i] ; k < scratch.rowStart[i+1] ; ++k )
+					{
+						const Rect &r = scratch.regions[scratch.rowRegions[k]];
+						for( int j = r.x ; j < r.x+r.width ; ++j )
+						{
+							if( obj[j] == 0 )
+								continue;
+							/* mean and STD of the 3 channels of the object in this band */
+							int o = obj[j]-1;
+							S *s = sums+sumStart[o]+(band-objBox[o].y/BACKGROUND_BAND_ROWS)*6;
+							s[0] += m[3*j];
+							s[1] += m[3*j+1];
+							s[2] += m[3*j+2];
+							s[3] += sd[3*j];
+							s[4] += sd[3*j+1];
+							s[5] += sd[3*j+2];
+						}
+					}
+				}
+			}
 		}
-		else if( (p1.x<mat.rows-1 && p1.y>0) && (mat.at<ushort>(p1.x+1, p1.y-1)==val1) && !visited.at<uchar>(p1.x+1, p1.y-1) )
+
+	private:
+		const Mat &current;
+		const Mat &objLabel;
+		Mat &cont, &mean, &STD;
+		bool update;
+		const vector<Rect> &objBox;
+		S *sums;
+		const MCSS_Scratch &scratch;
+};
+
+/* 
+ * built-in background model: the foreground mask of rows against the
+ * background statistics, which are then updated outside the mask. The
+ * statistics are float or the 16-bit fixed point of the integer only mode.
+ * */
+class ForegroundDetector : public ParallelLoopBody
+{
+	public:
+		ForegroundDetector(const Mat &_current, Mat &_cont, Mat &_mean, Mat &_STD, Mat &_mask,
+				Mat &_background, float _deviation, float _minDiff)
+			: current(_current), cont(_cont), mean(_mean), STD(_STD), mask(_mask),
+			background(_background), deviation(_deviation), minDiff(_minDiff),
+			fixedDeviation(cvRound(_deviation*256)), fixedMinDiff(cvRound(_minDiff*(1 << BG_FIXED_SHIFT)))
 		{
-			stack[topIndex++] = Point(p1.x+1, p1.y-1);
-			continue;
 		}
-		else if( (p1.x<mat.rows-1 && p1.y<mat.cols-1) && (mat.at<ushort>(p1.x+1, p1.y+1)==val1) && !visited.at<uchar>(p1.x+1, p1.y+1) )
+
+		void operator()(const Range &range) const
 		{
-			stack[topIndex++] = Point(p1.x+1, p1.y+1);
-			continue;
+			for( int i = range.start ; i < range.end ; ++i )
+			{
+				if( mean.depth() == CV_16S )
+				{
+					foregroundRowFixed(current.ptr<uchar>(i), cont.ptr<uchar>(i), mean.ptr<short>(i),
+							STD.ptr<short>(i), mask.ptr<uchar>(i), background.ptr<uchar>(i),
+							current.cols, fixedDeviation, fixedMinDiff, BG_FIXED_SHIFT);
+					backgroundRowFixed(current.ptr<uchar>(i), mask.ptr<uchar>(i), cont.ptr<uchar>(i),
+							mean.ptr<short>(i), STD.ptr<short>(i), current.cols, HISTORY, BG_FIXED_SHIFT);
+					continue;
+				}
+				foregroundRow(current.ptr<uchar>(i), cont.ptr<uchar>(i), mean.ptr<float>(i),
+						STD.ptr<float>(i), mask.ptr<uchar>(i), background.ptr<uchar>(i),
+						current.cols, deviation, minDiff);
+				backgroundRow(current.ptr<uchar>(i), mask.ptr<uchar>(i), cont.ptr<uchar>(i),
+						mean.ptr<float>(i), STD.ptr<float>(i), current.cols, HISTORY);
+			}
 		}
-		else
-			--topIndex;
+
+	private:
+		const Mat &current;
+		Mat &cont, &mean, &STD, &mask, &background;
+		float deviation, minDiff;
+		/* the same with 8 and BG_FIXED_SHIFT fractional bits */
+		int fixedDeviation, fixedMinDiff;
+};
+
+/**
+ * @brief fitStatistics: size the background statistics to the frames, in
+ *						 the type of the mode
+ *
+ * @param mean: running mean of each pixel
+ * @param STD: running mean absolute deviation of each pixel
+ * @param cont: frame count of each pixel
+ * @param size: frame size, the statistics start over if it changes
+ * @param integerOnly: 16-bit fixed point with BG_FIXED_SHIFT fractional bits, else float
+ */
+static void fitStatistics(Mat &mean, Mat &STD, Mat &cont, Size size, bool integerOnly)
+{
+	int type = integerOnly ? CV_16SC3 : CV_32FC3;
+
+	if( mean.size() != size )
+	{
+		mean = Mat::zeros(size, type);
+		STD = Mat::zeros(size, type);
+		cont = Mat::zeros(size, CV_8UC1);
+	}
+	else if( mean.type() != type )
+	{
+		/* the mode changed, what has been learnt so far is kept */
+		double scale = integerOnly ? 1 << BG_FIXED_SHIFT : 1.0/(1 << BG_FIXED_SHIFT);
+		mean.convertTo(mean, type, scale);
+		STD.convertTo(STD, type, scale);
 	}
-	return (num+1)/2;
 }
 
 /**
- * @brief findRegion: use DFS to label a foreground object with a unique index
+ * @brief isBelowRatio: num/den < ratio on integers, 0/0 is taken as 0
  *
- * @param mask: the binary image of foreground
- * @param label: the matrix to store each object's label
- * @param p: we start searching at this point
- * @param objIndex: the index of this object
+ * @param ratio: the ratio with RATIO_FIXED_SHIFT fractional bits
+ */
+static inline bool isBelowRatio(long long num, long long den, long long ratio)
+{
+	return den == 0 ? 0 < ratio : (num << RATIO_FIXED_SHIFT) < ratio*den;
+}
+
+/**
+ * @brief isLGCNode: check if a pixel can be reached when growing a local gradient constancy
  *
- * @return: number of points in this foreground object
+ * @param r: luminance ratio of the pixel, float or fixed point
+ * @param threshold1: the low threshold of the pixel in luminance ratio
+ * @param threshold2: the high threshold of the pixel in luminance ratio
+ *
+ * @return: true if all the channels lie in (threshold1, threshold2)
  */
-static long findRegion(Mat mask,
-		Mat label,
-		Point p,
-		int objIndex)
+template<typename P, typename T>
+static inline bool isLGCNode(const P &r, T threshold1, T threshold2)
 {
-	int topIndex = 0;
-	long num = 0;
-	Mat visited = Mat::zeros(mask.size(), CV_8UC1);
+	return r[0] < threshold2 && r[1] < threshold2 && r[2] < threshold2 &&
+		r[0] > threshold1 && r[1] > threshold1 && r[2] > threshold1;
+}
 
-	CV_Assert(mask.type() == CV_8UC1);
+/**
+ * @brief isLGCEdge: check if two 4-connected pixels have a constant gradient
+ *
+ * @param r1: luminance ratio of one pixel
+ * @param r2: luminance ratio of the other pixel
+ * @param mgThr: the minimum gradient threshold
+ *
+ * @return: true if the gradient is under the threshold in all the channels
+ */
+template<typename P, typename T>
+static inline bool isLGCEdge(const P &r1, const P &r2, const Vec<T, 3> &mgThr)
+{
+	return mgThr[0] > abs(r1[0]-r2[0]) &&
+		mgThr[1] > abs(r1[1]-r2[1]) &&
+		mgThr[2] > abs(r1[2]-r2[2]);
+}
 
-	if( mask.at<uchar>(p.x, p.y) == 0 )
-		return 0;
+/**
+ * @brief addRatio: add the luminance ratio of a pixel to the mean of its lgc
+ *
+ * @param r: luminance ratio of the pixel
+ * @param area: area of the lgc
+ * @param mean: the running mean of the lgc
+ * @param sum: the integer sum of the lgc, only used in fixed point
+ */
+static inline void addRatio(const Vec3f &r, int area, Vec3f &mean, long long *)
+{
+	mean[0] += r[0]/area;
+	mean[1] += r[1]/area;
+	mean[2] += r[2]/area;
+}
+
+static inline void addRatio(const Vec3w &r, int, Vec3f &, long long *sum)
+{
+	/* exact, the mean is divided out once the lgc is complete */
+	sum[0] += r[0];
+	sum[1] += r[1];
+	sum[2] += r[2];
+}
+
+/**
+ * @brief buildObjectTasks: cut the objects into the tasks of the per object passes
+ *
+ * Consecutive small objects are batched until their boxes reach
+ * OBJECT_TASK_PIXELS, an object with a box over twice that is a batch of
+ * its own and its rows are split into pieces of about that size.
+ *
+ * @param objBox: bounding box of each object
+ * @param scratch: workspace of the model, gets the pieces, the batches
+ *				   and the rows each split object is cut every
+ */
+static void buildObjectTasks(const vector<Rect> &objBox, MCSS_Scratch &scratch)
+{
+	vector<MCSS_Task> &pieces = scratch.pieces, &batches = scratch.batches;
+	int o, y, parts, rows, first = 0, pixels = 0, n = objBox.size();
 
-	visited.at<uchar>(p.x, p.y) = 255;
-	label.at<uchar>(p.x, p.y) = objIndex;
-	stack[topIndex++] = p;
-	while( topIndex )
+	pieces.clear();
+	batches.clear();
+	scratch.splitRows.assign(n, 0);
+	for( o = 0 ; o < n ; ++o )
 	{
-		Point p1 = stack[topIndex-1];
-		visited.at<uchar>(p1.x, p1.y) = 255;
-		label.at<uchar>(p1.x, p1.y) = objIndex;
-		++num;
-		// cerr << "topIndex = " << topIndex << ", (" << p1.x << "," << p1.y << ")" << endl;
-		if( (p1.x>0) && mask.at<uchar>(p1.x-1, p1.y) && !visited.at<uchar>(p1.x-1, p1.y) )
+		const Rect &b = objBox[o];
+		if( b.area() <= 2*OBJECT_TASK_PIXELS )
 		{
-			stack[topIndex++] = Point(p1.x-1, p1.y);
-			continue;
-		}
-		else if( (p1.y>0) && mask.at<uchar>(p1.x, p1.y-1) && !visited.at<uchar>(p1.x, p1.y-1) )
-		{
-			stack[topIndex++] = Point(p1.x, p1.y-1);
-			continue;
-		}
-		else if( (p1.x<mask.rows-1) && mask.at<uchar>(p1.x+1, p1.y) && !visited.at<uchar>(p1.x+1, p1.y) )
-		{
-			stack[topIndex++] = Point(p1.x+1, p1.y);
-			continue;
-		}
-		else if( (p1.y<mask.cols-1) && mask.at<uchar>(p1.x, p1.y+1) && !visited.at<uchar>(p1.x, p1.y+1) )
-		{
-			stack[topIndex++] = Point(p1.x, p1.y+1);
-			continue;
-		}
-		else if( (p1.x>0 && p1.y>0) && mask.at<uchar>(p1.x-1, p1.y-1) && !visited.at<uchar>(p1.x-1, p1.y-1) )
-		{
-			stack[topIndex++] = Point(p1.x-1, p1.y-1);
+			pixels += b.area();
+			if( pixels < OBJECT_TASK_PIXELS && o+1 < n )
+				continue;
+			pieces.push_back(MCSS_Task(first, o+1, 0, INT_MAX));
+			batches.push_back(pieces.back());
+			first = o+1;
+			pixels = 0;
 			continue;
 		}
-		else if( (p1.x>0 && p1.y<mask.cols-1) && mask.at<uchar>(p1.x-1, p1.y+1) && !visited.at<uchar>(p1.x-1, p1.y+1) )
+		if( first < o )
 		{
-			stack[topIndex++] = Point(p1.x-1, p1.y+1);
-			continue;
+			pieces.push_back(MCSS_Task(first, o, 0, INT_MAX));
+			batches.push_back(pieces.back());
 		}
-		else if( (p1.x<mask.rows-1 && p1.y>0) && mask.at<uchar>(p1.x+1, p1.y-1) && !visited.at<uchar>(p1.x+1, p1.y-1) )
+		parts = (b.area()+OBJECT_TASK_PIXELS-1)/OBJECT_TASK_PIXELS;
+		rows = (b.height+parts-1)/parts;
+		scratch.splitRows[o] = rows;
+		for( y = b.y ; y < b.y+b.height ; y += rows )
+			pieces.push_back(MCSS_Task(o, o+1, y, y+rows));
+		batches.push_back(MCSS_Task(o, o+1, 0, INT_MAX));
+		first = o+1;
+		pixels = 0;
+	}
+}
+
+/*
+ * label the LGC nodes of the pieces of the objects with union-find,
+ * a node's parent is stored as its linear pixel index. A piece only
+ * writes the nodes of its objects, the other pixels of the regions are
+ * -1 on entry, and never reads above its first row.
+ * P is the pixel type of lumRatio and T the type of the thresholds.
+ * */
+template<typename P, typename T>
+class LGCNodeLabeler : public ParallelLoopBody
+{
+	public:
+		LGCNodeLabeler(const Mat &_objLabel, const Mat &_lumRatio, Mat &_parent,
+				const vector<Vec<T, 3> > &_mgThr, T _threshold1, T _threshold2,
+				const vector<Rect> &_objBox, const MCSS_Scratch &_scratch)
+			: objLabel(_objLabel), lumRatio(_lumRatio), parent(_parent), mgThr(_mgThr),
+			threshold1(_threshold1), threshold2(_threshold2), objBox(_objBox), scratch(_scratch)
 		{
-			stack[topIndex++] = Point(p1.x+1, p1.y-1);
-			continue;
 		}
-		else if( (p1.x<mask.rows-1 && p1.y<mask.cols-1) && mask.at<uchar>(p1.x+1, p1.y+1) && !visited.at<uchar>(p1.x+1, p1.y+1) )
+
+		void operator()(const Range &range) const
 		{
-			stack[topIndex++] = Point(p1.x+1, p1.y+1);
-			continue;
+			int *p = (int *)parent.data;
+			for( int t = range.start ; t < range.end ; ++t )
+			{
+				const MCSS_Task &task = scratch.pieces[t];
+				for( int o = task.first ; o < task.last ; ++o )
+				{
+					const Rect &b = objBox[o];
+					const Vec<T, 3> &thr = mgThr[o];
+					int rowBegin = MAX(b.y, task.rowBegin), rowEnd = MIN(b.y+b.height, task.rowEnd);
+					for( int i = rowBegin ; i < rowEnd ; ++i )
+					{
+						const int *obj = objLabel.ptr<int>(i);
+						const P *lr = lumRatio.ptr<P>(i);
+						const P *lrUp = i > rowBegin ? lumRatio.ptr<P>(i-1) : NULL;
+						int *cur = parent.ptr<int>(i);
+						const int *up = i > rowBegin ? parent.ptr<int>(i-1) : NULL;
+						int idx = i*objLabel.cols+b.x;
+						for( int j = b.x ; j < b.x+b.width ; ++j, ++idx )
+						{
+							if( obj[j] != o+1 || !isLGCNode(lr[j], threshold1, threshold2) )
+								continue;
+							cur[j] = idx;
+							if( j > b.x && cur[j-1] >= 0 && isLGCEdge(lr[j], lr[j-1], thr) )
+								unionRoot(p, idx, idx-1);
+							if( up && up[j] >= 0 && isLGCEdge(lr[j], lrUp[j], thr) )
+								unionRoot(p, idx, idx-objLabel.cols);
+						}
+					}
+				}
+			}
 		}
-		else
-			--topIndex;
-	}
-	return (num+1)/2;
-}
+
+	private:
+		const Mat &objLabel;
+		const Mat &lumRatio;
+		Mat &parent;
+		const vector<Vec<T, 3> > &mgThr;
+		T threshold1, threshold2;
+		const vector<Rect> &objBox;
+		const MCSS_Scratch &scratch;
+};
 
 /**
- * @brief findLGC: find a local gradient constancy
+ * @brief labelObjectLGC: find the local gradient constancy regions of one object
+ *
+ * The node components are merged across the rows the object was split
+ * at, then the seeds are replayed in raster order: a seed inside a node
+ * component grows that component, a seed outside the thresholds grows
+ * itself plus all the node components linked to it (even the labeled
+ * ones). The statistics of each lgc the classification needs are
+ * gathered while the labels are written. Only the pixels of the object
+ * are written, and it never touches another object (they are not
+ * 8-connected), so the objects can run at the same time.
  *
  * @param objLabel: objects mask
  * @param lumRatio: luminance ratio matrix
- * @param lgcLabel: local gradient constancy matrix
- * @param p: start point
- * @param lgcIndex: lgc index
- * @param mgThr: the minimum gradient threshold
- * @param threshold1: the low threshold of the pixel in luminance ratio
- * @param threshold2: the high threshold of the pixel in luminance ratio
- *
- * @return: number of points in this lgc
+ * @param compLabel: the node components of LGCNodeLabeler, resolved to
+ *					 -(index+2) of the component in the table on the way
+ * @param lgcLabel: local gradient constancy matrix, numbered in the table
+ * @param label: label of the object
+ * @param box: bounding box of the object
+ * @param splitRows: the object was split every splitRows rows, 0 if not
+ * @param thr: the minimum gradient threshold of the object
+ * @param table: the lgc table of the batch, gets the lgcs of the object
  */
-static long findLGC(Mat objLabel,
-		Mat lumRatio,
-		Mat lgcLabel,
-		Point p,
-		int lgcIndex,
-		Vec3f mgThr,
-		float threshold1 = 1,
-		float threshold2 = 5)
+template<typename P, typename T>
+static void labelObjectLGC(const Mat &objLabel,
+		const Mat &lumRatio,
+		Mat &compLabel,
+		Mat &lgcLabel,
+		int label,
+		const Rect &box,
+		int splitRows,
+		const Vec<T, 3> &thr,
+		MCSS_LGCTable &table)
 {
-	int topIndex = 0;
-	long num = 0;
-	Mat visited = Mat::zeros(objLabel.size(), CV_8UC1);
+	int i, j, k, idx, rows = objLabel.rows, cols = objLabel.cols;
+	int x1 = box.x+box.width, y1 = box.y+box.height;
+	int *parent = (int *)compLabel.data;
+	vector<int> &compArea = table.compArea, &compLGC = table.compLGC;
+	int first = table.area.size();
 
-	if( objLabel.at<uchar>(p.x, p.y) == 0 )
-		return 0;
+	/* merge the components across the seams */
+	for( i = box.y+splitRows ; splitRows > 0 && i < y1 ; i += splitRows )
+	{
+		const int *obj = objLabel.ptr<int>(i);
+		const P *lr = lumRatio.ptr<P>(i);
+		const P *lrUp = lumRatio.ptr<P>(i-1);
+		const int *cur = compLabel.ptr<int>(i);
+		const int *up = compLabel.ptr<int>(i-1);
+		for( j = box.x ; j < x1 ; ++j )
+		{
+			if( obj[j] == label && cur[j] >= 0 && up[j] >= 0 && isLGCEdge(lr[j], lrUp[j], thr) )
+				unionRoot(parent, i*cols+j, (i-1)*cols+j);
+		}
+	}
 
-	visited.at<uchar>(p.x, p.y) = 255;
-	lgcLabel.at<ushort>(p.x, p.y) = lgcIndex;
-	stack[topIndex++] = p;
-	while( topIndex )
+	/*
+	 * resolve the components to compact indices, encoded as -(index+2)
+	 * so that they can't be taken as a parent
+	 * */
+	for( i = box.y ; i < y1 ; ++i )
 	{
-		Point p1 = stack[topIndex-1];
-		visited.at<uchar>(p1.x, p1.y) = 255;
-		lgcLabel.at<ushort>(p1.x, p1.y) = lgcIndex;
-		++num;
-		if( (p1.x>0) && objLabel.at<uchar>(p1.x-1, p1.y) && !visited.at<uchar>(p1.x-1, p1.y) )
-		{
-			float b1, g1, r1, b2, g2, r2;
-			b1 = lumRatio.at<Vec3f>(p1.x, p1.y)[0];
-			b2 = lumRatio.at<Vec3f>(p1.x-1, p1.y)[0];
-			g1 = lumRatio.at<Vec3f>(p1.x, p1.y)[1];
-			g2 = lumRatio.at<Vec3f>(p1.x-1, p1.y)[1];
-			r1 = lumRatio.at<Vec3f>(p1.x, p1.y)[2];
-			r2 = lumRatio.at<Vec3f>(p1.x-1, p1.y)[2];
-			if( mgThr[0] > abs(b1-b2) &&
-					mgThr[1] > abs(g1-g2) &&
-					mgThr[2] > abs(r1-r2) &&
-					b2 < threshold2 && g2 < threshold2 && r2 < threshold2 &&
-					b2 > threshold1 && g2 > threshold1 && r2 > threshold1 )
-			{
-				stack[topIndex++] = Point(p1.x-1, p1.y);
+		const int *obj = objLabel.ptr<int>(i);
+		for( j = box.x, idx = i*cols+box.x ; j < x1 ; ++j, ++idx )
+		{
+			if( obj[j] != label || parent[idx] == -1 )
 				continue;
-			}
-		}
-		if( (p1.y>0) && objLabel.at<uchar>(p1.x, p1.y-1) && !visited.at<uchar>(p1.x, p1.y-1) )
-		{
-			float b1, g1, r1, b2, g2, r2;
-			b1 = lumRatio.at<Vec3f>(p1.x, p1.y)[0];
-			b2 = lumRatio.at<Vec3f>(p1.x, p1.y-1)[0];
-			g1 = lumRatio.at<Vec3f>(p1.x, p1.y)[1];
-			g2 = lumRatio.at<Vec3f>(p1.x, p1.y-1)[1];
-			r1 = lumRatio.at<Vec3f>(p1.x, p1.y)[2];
-			r2 = lumRatio.at<Vec3f>(p1.x, p1.y-1)[2];
-			if(mgThr[0] > abs(b1-b2) &&
-					mgThr[1] > abs(g1-g2) &&
-					mgThr[2] > abs(r1-r2) &&
-					b2 < threshold2 && g2 < threshold2 && r2 < threshold2 &&
-					b2 > threshold1 && g2 > threshold1 && r2 > threshold1 )
+			if( parent[idx] == idx )
 			{
-				stack[topIndex++] = Point(p1.x, p1.y-1);
-				continue;
+				parent[idx] = -((int)compArea.size()+2);
+				compArea.push_back(0);
 			}
+			else
+				parent[idx] = parent[parent[idx]];
+			++compArea[-parent[idx]-2];
 		}
-		if( (p1.x<objLabel.rows-1) && objLabel.at<uchar>(p1.x+1, p1.y) && !visited.at<uchar>(p1.x+1, p1.y) )
-		{
-			float b1, g1, r1, b2, g2, r2;
-			b1 = lumRatio.at<Vec3f>(p1.x, p1.y)[0];
-			b2 = lumRatio.at<Vec3f>(p1.x+1, p1.y)[0];
-			g1 = lumRatio.at<Vec3f>(p1.x, p1.y)[1];
-			g2 = lumRatio.at<Vec3f>(p1.x+1, p1.y)[1];
-			r1 = lumRatio.at<Vec3f>(p1.x, p1.y)[2];
-			r2 = lumRatio.at<Vec3f>(p1.x+1, p1.y)[2];
-			if(mgThr[0] > abs(b1-b2) &&
-					mgThr[1] > abs(g1-g2) &&
-					mgThr[2] > abs(r1-r2) &&
-					b2 < threshold2 && g2 < threshold2 && r2 < threshold2 &&
-					b2 > threshold1 && g2 > threshold1 && r2 > threshold1 )
-			{
-				stack[topIndex++] = Point(p1.x+1, p1.y);
+	}
+
+	/* replay the seeds in raster order */
+	growCapacity(compLGC, compArea.size());
+	compLGC.resize(compArea.size(), 0);
+	for( i = box.y ; i < y1 ; ++i )
+	{
+		const int *obj = objLabel.ptr<int>(i);
+		const P *lr = lumRatio.ptr<P>(i);
+		const int *comp = compLabel.ptr<int>(i);
+		int *lgc = lgcLabel.ptr<int>(i);
+		for( j = box.x ; j < x1 ; ++j )
+		{
+			if( obj[j] != label )
 				continue;
-			}
-		}
-		if( (p1.y<objLabel.cols-1) && objLabel.at<uchar>(p1.x, p1.y+1) && !visited.at<uchar>(p1.x, p1.y+1) )
-		{
-			float b1, g1, r1, b2, g2, r2;
-			b1 = lumRatio.at<Vec3f>(p1.x, p1.y)[0];
-			b2 = lumRatio.at<Vec3f>(p1.x, p1.y+1)[0];
-			g1 = lumRatio.at<Vec3f>(p1.x, p1.y)[1];
-			g2 = lumRatio.at<Vec3f>(p1.x, p1.y+1)[1];
-			r1 = lumRatio.at<Vec3f>(p1.x, p1.y)[2];
-			r2 = lumRatio.at<Vec3f>(p1.x, p1.y+1)[2];
-			if(mgThr[0] > abs(b1-b2) &&
-					mgThr[1] > abs(g1-g2) &&
-					mgThr[2] > abs(r1-r2) &&
-					b2 < threshold2 && g2 < threshold2 && r2 < threshold2 &&
-					b2 > threshold1 && g2 > threshold1 && r2 > threshold1 )
-			{
-				stack[topIndex++] = Point(p1.x, p1.y+1);
+			int c = comp[j] == -1 ? -1 : -comp[j]-2;
+			if( lr[j] == P::all(0) || (c >= 0 && compLGC[c] != 0) )
 				continue;
-			}
-		}
-#if 0
-		if( (p1.x>0 && p1.y>0) && objLabel.at<uchar>(p1.x-1, p1.y-1) && !visited.at<uchar>(p1.x-1, p1.y-1) )
-		{
-			float b1, g1, r1, b2, g2, r2;
-			b1 = lumRatio.at<Vec3f>(p1.x, p1.y)[0];
-			b2 = lumRatio.at<Vec3f>(p1.x-1, p1.y-1)[0];
-			g1 = lumRatio.at<Vec3f>(p1.x, p1.y)[1];
-			g2 = lumRatio.at<Vec3f>(p1.x-1, p1.y-1)[1];
-			r1 = lumRatio.at<Vec3f>(p1.x, p1.y)[2];
-			r2 = lumRatio.at<Vec3f>(p1.x-1, p1.y-1)[2];
-			if(mgThr[0] > abs(b1-b2) &&
-					mgThr[1] > abs(g1-g2) &&
-					mgThr[2] > abs(r1-r2) &&
-					b2 < threshold2 && g2 < threshold2 && r2 < threshold2 &&
-					b2 > threshold1 && g2 > threshold1 && r2 > threshold1 )
+			if( thr[0] == 0 && thr[1] == 0 && thr[2] == 0 )
 			{
-				stack[topIndex++] = Point(p1.x-1, p1.y-1);
+				++table.rejected;
+				if( c >= 0 )
+					compLGC[c] = SMALL_LGC_LABEL;
+				else
+					lgc[j] = SMALL_LGC_LABEL;
 				continue;
 			}
-		}
-		if( (p1.x>0 && (p1.y<objLabel.cols-1)) && objLabel.at<uchar>(p1.x-1, p1.y+1) && !visited.at<uchar>(p1.x-1, p1.y+1) )
-		{
-			float b1, g1, r1, b2, g2, r2;
-			b1 = lumRatio.at<Vec3f>(p1.x, p1.y)[0];
-			b2 = lumRatio.at<Vec3f>(p1.x-1, p1.y+1)[0];
-			g1 = lumRatio.at<Vec3f>(p1.x, p1.y)[1];
-			g2 = lumRatio.at<Vec3f>(p1.x-1, p1.y+1)[1];
-			r1 = lumRatio.at<Vec3f>(p1.x, p1.y)[2];
-			r2 = lumRatio.at<Vec3f>(p1.x-1, p1.y+1)[2];
-			if(mgThr[0] > abs(b1-b2) &&
-					mgThr[1] > abs(g1-g2) &&
-					mgThr[2] > abs(r1-r2) &&
-					b2 < threshold2 && g2 < threshold2 && r2 < threshold2 &&
-					b2 > threshold1 && g2 > threshold1 && r2 > threshold1 )
+
+			int linked[4], linkedNum = 0, area = 0, l;
+			if( c >= 0 )
+				linked[linkedNum++] = c;
+			else
 			{
-				stack[topIndex++] = Point(p1.x-1, p1.y+1);
-				continue;
+				/* a seed outside the thresholds can only step onto the nodes around it */
+				int n[4], nNum = 0;
+				if( i > 0 ) n[nNum++] = (i-1)*cols+j;
+				if( j > 0 ) n[nNum++] = i*cols+j-1;
+				if( i < rows-1 ) n[nNum++] = (i+1)*cols+j;
+				if( j < cols-1 ) n[nNum++] = i*cols+j+1;
+				for( k = 0 ; k < nNum ; ++k )
+				{
+					if( parent[n[k]] == -1 || !isLGCEdge(lr[j], ((const P *)lumRatio.data)[n[k]], thr) )
+						continue;
+					int nc = -parent[n[k]]-2;
+					for( l = 0 ; l < linkedNum && linked[l] != nc ; ++l )
+						;
+					if( l == linkedNum )
+						linked[linkedNum++] = nc;
+				}
+				area = 1;
 			}
-		}
-		if( ((p1.x<objLabel.rows-1) && p1.y>0) && objLabel.at<uchar>(p1.x+1, p1.y-1) && !visited.at<uchar>(p1.x+1, p1.y-1) )
-		{
-			float b1, g1, r1, b2, g2, r2;
-			b1 = lumRatio.at<Vec3f>(p1.x, p1.y)[0];
-			b2 = lumRatio.at<Vec3f>(p1.x+1, p1.y-1)[0];
-			g1 = lumRatio.at<Vec3f>(p1.x, p1.y)[1];
-			g2 = lumRatio.at<Vec3f>(p1.x+1, p1.y-1)[1];
-			r1 = lumRatio.at<Vec3f>(p1.x, p1.y)[2];
-			r2 = lumRatio.at<Vec3f>(p1.x+1, p1.y-1)[2];
-			if(mgThr[0] > abs(b1-b2) &&
-					mgThr[1] > abs(g1-g2) &&
-					mgThr[2] > abs(r1-r2) &&
-					b2 < threshold2 && g2 < threshold2 && r2 < threshold2 &&
-					b2 > threshold1 && g2 > threshold1 && r2 > threshold1 )
+			for( k = 0 ; k < linkedNum ; ++k )
+				area += compArea[linked[k]];
+
+			int lgcIdx;
+			/* label each of the small region to a fixed number */
+			if( area < MIN_LGC_AREA )
+			{
+				++table.rejected;
+				lgcIdx = SMALL_LGC_LABEL;
+			}
+			else
 			{
-				stack[topIndex++] = Point(p1.x+1, p1.y-1);
+				table.area.push_back(area);
+				table.object.push_back(label);
+				lgcIdx = table.area.size();
+			}
+			for( k = 0 ; k < linkedNum ; ++k )
+				compLGC[linked[k]] = lgcIdx;
+			if( c < 0 )
+				lgc[j] = lgcIdx;
+		}
+	}
+
+	/*
+	 * write the labels of the node components, and on the way gather the
+	 * luminance ratio and the terminal pixels of each lgc
+	 * (Part III. MOVING SHADOW DETECTION, E. Classification Process)
+	 * */
+	int lgcNum = table.area.size();
+	const int *lgcData = (const int *)lgcLabel.data;
+	const int *objData = (const int *)objLabel.data;
+	growCapacity(table.mean, lgcNum);
+	growCapacity(table.sum, 3*lgcNum);
+	growCapacity(table.external, lgcNum);
+	growCapacity(table.all, lgcNum);
+	table.mean.resize(lgcNum, Vec3f(0, 0, 0));
+	table.sum.resize(3*lgcNum, 0);
+	table.external.resize(lgcNum, 0);
+	table.all.resize(lgcNum, 0);
+	for( i = box.y ; i < y1 ; ++i )
+	{
+		const int *obj = objLabel.ptr<int>(i);
+		const P *lr = lumRatio.ptr<P>(i);
+		const int *comp = compLabel.ptr<int>(i);
+		int *lgc = lgcLabel.ptr<int>(i);
+		for( j = box.x ; j < x1 ; ++j )
+		{
+			if( obj[j] != label )
+				continue;
+			if( comp[j] != -1 )
+				lgc[j] = compLGC[-comp[j]-2];
+			int l = lgc[j];
+			if( l == 0 || l == SMALL_LGC_LABEL )
 				continue;
+			addRatio(lr[j], table.area[l-1], table.mean[l-1], &table.sum[3*(l-1)]);
+
+			/*
+			 * a terminal pixel has an 8-neighbour out of its lgc, an external
+			 * one also has an 8-neighbour out of its object. The neighbours
+			 * below and on the right are not written yet, their label comes
+			 * from their component.
+			 * */
+			bool terminal = false, outside = false;
+			for( int di = -1 ; di <= 1 ; ++di )
+			{
+				for( int dj = -1 ; dj <= 1 ; ++dj )
+				{
+					int ni = i+di, nj = j+dj, n = ni*cols+nj;
+					if( (di == 0 && dj == 0) || ni < 0 || ni >= rows || nj < 0 || nj >= cols )
+						continue;
+					int nLabel = parent[n] != -1 ? compLGC[-parent[n]-2] : lgcData[n];
+					if( nLabel != l )
+						terminal = true;
+					if( objData[n] != obj[j] )
+						outside = true;
+				}
+			}
+			if( terminal )
+			{
+				++table.all[l-1];
+				if( outside )
+					++table.external[l-1];
 			}
 		}
-		if( ((p1.x<objLabel.rows-1) && (p1.y<objLabel.cols-1)) && objLabel.at<uchar>(p1.x+1, p1.y+1) && !visited.at<uchar>(p1.x+1, p1.y+1) )
-		{
-			float b1, g1, r1, b2, g2, r2;
-			b1 = lumRatio.at<Vec3f>(p1.x, p1.y)[0];
-			b2 = lumRatio.at<Vec3f>(p1.x+1, p1.y+1)[0];
-			g1 = lumRatio.at<Vec3f>(p1.x, p1.y)[1];
-			g2 = lumRatio.at<Vec3f>(p1.x+1, p1.y+1)[1];
-			r1 = lumRatio.at<Vec3f>(p1.x, p1.y)[2];
-			r2 = lumRatio.at<Vec3f>(p1.x+1, p1.y+1)[2];
-			if(mgThr[0] > abs(b1-b2) &&
-					mgThr[1] > abs(g1-g2) &&
-					mgThr[2] > abs(r1-r2) &&
-					b2 < threshold2 && g2 < threshold2 && r2 < threshold2 &&
-					b2 > threshold1 && g2 > threshold1 && r2 > threshold1 )
+	}
+	if( lumRatio.depth() == CV_16U )
+	{
+		for( i = first ; i < lgcNum ; ++i )
+		{
+			double area = (double)table.area[i]*(1 << LUMRATIO_FIXED_SHIFT);
+			table.mean[i][0] = (float)(table.sum[3*i]/area);
+			table.mean[i][1] = (float)(table.sum[3*i+1]/area);
+			table.mean[i][2] = (float)(table.sum[3*i+2]/area);
+		}
+	}
+}
+
+/* run labelObjectLGC on the objects of batches, each batch has its own lgc table */
+template<typename P, typename T>
+class LGCObjectLabeler : public ParallelLoopBody
+{
+	public:
+		LGCObjectLabeler(const Mat &_objLabel, const Mat &_lumRatio, Mat &_compLabel, Mat &_lgcLabel,
+				const vector<Vec<T, 3> > &_mgThr, const vector<Rect> &_objBox, MCSS_Scratch &_scratch)
+			: objLabel(_objLabel), lumRatio(_lumRatio), compLabel(_compLabel), lgcLabel(_lgcLabel),
+			mgThr(_mgThr), objBox(_objBox), scratch(_scratch)
+		{
+		}
+
+		void operator()(const Range &range) const
+		{
+			for( int t = range.start ; t < range.end ; ++t )
 			{
-				stack[topIndex++] = Point(p1.x+1, p1.y+1);
-				continue;
+				const MCSS_Task &task = scratch.batches[t];
+				MCSS_LGCTable &table = scratch.lgcTables[t];
+				/* clear keeps the capacity of the last frames */
+				table.compArea.clear();
+				table.compLGC.clear();
+				table.area.clear();
+				table.object.clear();
+				table.external.clear();
+				table.all.clear();
+				table.mean.clear();
+				table.sum.clear();
+				table.rejected = 0;
+				for( int o = task.first ; o < task.last ; ++o )
+					labelObjectLGC<P, T>(objLabel, lumRatio, compLabel, lgcLabel, o+1, objBox[o],
+							scratch.splitRows[o], mgThr[o], table);
 			}
 		}
+
+	private:
+		const Mat &objLabel;
+		const Mat &lumRatio;
+		Mat &compLabel, &lgcLabel;
+		const vector<Vec<T, 3> > &mgThr;
+		const vector<Rect> &objBox;
+		MCSS_Scratch &scratch;
+};
+
+/**
+ * @brief reserveTable: make room in the table of a batch
+ *
+ * @param table: the table
+ * @param comps: node components it can hold
+ * @param lgcs: lgcs it can hold
+ */
+static void reserveTable(MCSS_LGCTable &table, size_t comps, size_t lgcs)
+{
+	table.compArea.reserve(comps);
+	table.compLGC.reserve(comps);
+	table.area.reserve(lgcs);
+	table.object.reserve(lgcs);
+	table.external.reserve(lgcs);
+	table.all.reserve(lgcs);
+	table.mean.reserve(lgcs);
+	table.sum.reserve(3*lgcs);
+}
+
+/**
+ * @brief labelLGC: find all the local gradient constancy regions
+ *
+ * A pixel whose luminance ratio lies in (threshold1, threshold2) is a node,
+ * and two 4-connected nodes are linked if their gradient is under mgThr.
+ * The objects are independent: their node components are labeled in
+ * parallel pieces (see buildObjectTasks), then each batch of objects
+ * replays its seeds and gathers its statistics into its own table
+ * (see labelObjectLGC). The tables are joined in object order, so the lgcs
+ * are numbered object by object whatever the threads. The lgc labels of
+ * the pixels are left in the numbers of their batch, lgcOffset of the
+ * scratch gets what moves them to the frame's (see ObjectClassifier).
+ * The same code runs on the float and on the fixed point luminance ratio,
+ * P is the pixel type of lumRatio and T the type of the thresholds.
+ *
+ * @param objLabel: objects mask
+ * @param lumRatio: luminance ratio matrix
+ * @param lgcLabel: local gradient constancy matrix, must be zero inside the regions on entry
+ * @param mgThr: the minimum gradient threshold of each object
+ * @param threshold1: the low threshold of the pixel in luminance ratio
+ * @param threshold2: the high threshold of the pixel in luminance ratio
+ * @param objBox: bounding box of each object
+ * @param lgcArea: area of each lgc
+ * @param lgcToObj: the object index of each lgc
+ * @param meanLGC: mean luminance ratio of each lgc
+ * @param scratch: workspace of the model, gets the tasks, the number of
+ *				   external terminal pixels and all terminal pixels of each
+ *				   lgc, and the integer sums of the luminance ratio in fixed point
+ * @param stats: gets the time of the two LGC stages and the LGC counters
+ *
+ * @return: number of lgc regions
+ */
+template<typename P, typename T>
+static int labelLGC(Mat objLabel,
+		Mat lumRatio,
+		Mat lgcLabel,
+		const vector<Vec<T, 3> > &mgThr,
+		T threshold1,
+		T threshold2,
+		const vector<Rect> &objBox,
+		vector<int> &lgcArea,
+		vector<int> &lgcToObj,
+		vector<Vec3f> &meanLGC,
+		MCSS_Scratch &scratch,
+		MCSS_Stats &stats)
+{
+	int k, o, lgcNum = 0;
+	size_t tableComps, tableLGCs;
+	Mat &compLabel = scratch.labels;
+	const vector<Rect> &regions = scratch.regions;
+	const vector<MCSS_Task> &batches = scratch.batches;
+	vector<int> &external = scratch.external, &all = scratch.all, &lgcOffset = scratch.lgcOffset;
+	vector<long long> &lgcSum = scratch.lgcSum;
+
+	CV_Assert(objLabel.type() == CV_32SC1 && objLabel.isContinuous());
+	CV_Assert(lumRatio.type() == DataType<P>::type && lumRatio.isContinuous());
+	CV_Assert(lgcLabel.type() == CV_32SC1 && lgcLabel.isContinuous());
+	CV_Assert(compLabel.type() == CV_32SC1 && compLabel.size() == objLabel.size() && compLabel.isContinuous());
+	STATS(int64 tick = getTickCount());
+	STATS(int comps = 0);
+
+	/* label the node components of each piece, the pixels out of the objects are no node */
+	buildObjectTasks(objBox, scratch);
+	for( k = 0 ; k < (int)regions.size() ; ++k )
+		compLabel(regions[k]).setTo(Scalar::all(-1));
+	parallel_for_(Range(0, scratch.pieces.size()), LGCNodeLabeler<P, T>(objLabel, lumRatio, compLabel,
+				mgThr, threshold1, threshold2, objBox, scratch));
+	STATS(stats.stageTime[STAGE_LGC] += lap(tick));
+
+	/* the lgcs and their statistics, batch by batch */
+	/*
+	 * the batches change from frame to frame, so every table gets the room
+	 * of the largest one, whichever batch the next big object falls in
+	 * */
+	tableComps = tableLGCs = RESERVED_BATCH_LGCS;
+	for( k = 0 ; k < (int)scratch.lgcTables.size() ; ++k )
+	{
+		tableComps = MAX(tableComps, scratch.lgcTables[k].compArea.capacity());
+		tableLGCs = MAX(tableLGCs, scratch.lgcTables[k].area.capacity());
+	}
+	if( scratch.lgcTables.size() < batches.size() )
+		scratch.lgcTables.resize(batches.size());
+	for( k = 0 ; k < (int)scratch.lgcTables.size() ; ++k )
+		reserveTable(scratch.lgcTables[k], tableComps, tableLGCs);
+	parallel_for_(Range(0, batches.size()), LGCObjectLabeler<P, T>(objLabel, lumRatio, compLabel, lgcLabel,
+				mgThr, objBox, scratch));
+
+	/* join the tables in object order */
+	lgcOffset.resize(objBox.size());
+	external.clear();
+	all.clear();
+	lgcSum.clear();
+	for( k = 0 ; k < (int)batches.size() ; ++k )
+	{
+		const MCSS_LGCTable &table = scratch.lgcTables[k];
+		for( o = batches[k].first ; o < batches[k].last ; ++o )
+			lgcOffset[o] = lgcNum;
+		lgcNum += table.area.size();
+		lgcArea.insert(lgcArea.end(), table.area.begin(), table.area.end());
+		lgcToObj.insert(lgcToObj.end(), table.object.begin(), table.object.end());
+		meanLGC.insert(meanLGC.end(), table.mean.begin(), table.mean.end());
+		external.insert(external.end(), table.external.begin(), table.external.end());
+		all.insert(all.end(), table.all.begin(), table.all.end());
+		lgcSum.insert(lgcSum.end(), table.sum.begin(), table.sum.end());
+		STATS(stats.rejectedLGCs += table.rejected);
+		STATS(comps += table.compArea.size());
+	}
+
+#ifndef MCSS_NO_STATS
+	stats.peakLabels = MAX(stats.peakLabels, comps);
+	for( k = 0 ; k < (int)objBox.size() ; ++k )
+		stats.visitedPixels += objBox[k].area();
+	stats.stageTime[STAGE_LGC_STATS] += lap(tick);
+	stats.lgcs = lgcNum;
 #endif
-		--topIndex;
+	return lgcNum;
+}
+
+/*
+ * classify the pixels of the pieces of the objects by the decision of
+ * their lgc (Part III. MOVING SHADOW DETECTION, E. Classification Process),
+ * and on the way move the lgc labels from the numbers of their batch to
+ * the frame's (lgcOffset, 0 for the objects that kept the lgcs of the
+ * last frame, which have these already)
+ * */
+class ObjectClassifier : public ParallelLoopBody
+{
+	public:
+		ObjectClassifier(const Mat &_objLabel, Mat &_lgcLabel, Mat &_dst, const vector<bool> &_lgcIsShadow,
+				const vector<Rect> &_objBox, const MCSS_Scratch &_scratch)
+			: objLabel(_objLabel), lgcLabel(_lgcLabel), dst(_dst), lgcIsShadow(_lgcIsShadow),
+			objBox(_objBox), scratch(_scratch)
+		{
+		}
+
+		void operator()(const Range &range) const
+		{
+			for( int t = range.start ; t < range.end ; ++t )
+			{
+				const MCSS_Task &task = scratch.pieces[t];
+				for( int o = task.first ; o < task.last ; ++o )
+				{
+					const Rect &b = objBox[o];
+					int offset = scratch.lgcOffset[o];
+					int rowBegin = MAX(b.y, task.rowBegin), rowEnd = MIN(b.y+b.height, task.rowEnd);
+					for( int i = rowBegin ; i < rowEnd ; ++i )
+					{
+						const int *obj = objLabel.ptr<int>(i);
+						int *lgc = lgcLabel.ptr<int>(i);
+						uchar *d = dst.ptr<uchar>(i);
+						for( int j = b.x ; j < b.x+b.width ; ++j )
+						{
+							if( obj[j] != o+1 || lgc[j] == 0 )
+								continue;
+							if( lgc[j] == SMALL_LGC_LABEL )
+							{
+								d[j] = 255;
+								continue;
+							}
+							lgc[j] += offset;
+							if( d[j] != 255 && d[j] != 0 && !lgcIsShadow[lgc[j]-1] )
+								d[j] = 255;
+						}
+					}
+				}
+			}
+		}
+
+	private:
+		const Mat &objLabel;
+		Mat &lgcLabel, &dst;
+		const vector<bool> &lgcIsShadow;
+		const vector<Rect> &objBox;
+		const MCSS_Scratch &scratch;
+};
+
+/*
+ * edge noise correction (F. Edge Noise Correction): the fringe pixels the
+ * erosion took from the objects get the value of the nearest shadow (127)
+ * or foreground (255) pixel of their region in chessboard distance, the
+ * shadow on a tie. A forward and a backward sweep carry 2*distance+1 for
+ * the foreground or 2*distance for the shadow of the nearest such pixel,
+ * so a region costs two passes whatever its fringe. The fringe of a
+ * region without any such pixel stays background.
+ * */
+class FringeCorrector : public ParallelLoopBody
+{
+	public:
+		FringeCorrector(Mat &_res, const Mat &_fringe, Mat &_nearest, const vector<Rect> &_regions)
+			: res(_res), fringe(_fringe), nearest(_nearest), regions(_regions)
+		{
+		}
+
+		void operator()(const Range &range) const
+		{
+			for( int k = range.start ; k < range.end ; ++k )
+			{
+				const Rect &r = regions[k];
+				int x1 = r.x+r.width, y1 = r.y+r.height, i, j, c;
+				/* forward sweep: the pixel itself, its left neighbour and the three above */
+				for( i = r.y ; i < y1 ; ++i )
+				{
+					const uchar *d = res.ptr<uchar>(i);
+					int *cur = nearest.ptr<int>(i);
+					const int *up = i > r.y ? nearest.ptr<int>(i-1) : NULL;
+					for( j = r.x ; j < x1 ; ++j )
+					{
+						c = d[j] == 127 ? 0 : d[j] == 255 ? 1 : FRINGE_FAR;
+						if( j > r.x )
+							c = MIN(c, cur[j-1]+2);
+						if( up != NULL )
+						{
+							c = MIN(c, up[j]+2);
+							if( j > r.x )
+								c = MIN(c, up[j-1]+2);
+							if( j+1 < x1 )
+								c = MIN(c, up[j+1]+2);
+						}
+						cur[j] = c;
+					}
+				}
+				/* backward sweep: its right neighbour and the three below, then the fringe is set */
+				for( i = y1-1 ; i >= r.y ; --i )
+				{
+					uchar *d = res.ptr<uchar>(i);
+					const uchar *f = fringe.ptr<uchar>(i);
+					int *cur = nearest.ptr<int>(i);
+					const int *down = i+1 < y1 ? nearest.ptr<int>(i+1) : NULL;
+					for( j = x1-1 ; j >= r.x ; --j )
+					{
+						c = cur[j];
+						if( j+1 < x1 )
+							c = MIN(c, cur[j+1]+2);
+						if( down != NULL )
+						{
+							c = MIN(c, down[j]+2);
+							if( j > r.x )
+								c = MIN(c, down[j-1]+2);
+							if( j+1 < x1 )
+								c = MIN(c, down[j+1]+2);
+						}
+						cur[j] = c;
+						if( f[j] != 0 && c < FRINGE_FAR )
+							d[j] = (c & 1) ? 255 : 127;
+					}
+				}
+			}
+		}
+
+	private:
+		Mat &res;
+		const Mat &fringe;
+		Mat &nearest;
+		const vector<Rect> &regions;
+};
+
+/**
+ * @brief buildRatioTable: precompute the fixed point luminance ratio of every byte pair
+ *
+ * @param table: 256x256 table indexed by (background, current)
+ * @param v: the offset of the luminance ratio
+ */
+static void buildRatioTable(Mat &table, float v)
+{
+	int b, c;
+
+	table.create(256, 256, CV_16UC1);
+	for( b = 0 ; b < 256 ; ++b )
+	{
+		ushort *row = table.ptr<ushort>(b);
+		for( c = 0 ; c < 256 ; ++c )
+		{
+			/* round the float ratio, so the error is at most half a unit */
+			float ratio = (b+v)/(c+v);
+			row[c] = saturate_cast<ushort>(ratio*(double)(1 << LUMRATIO_FIXED_SHIFT));
+		}
+	}
+}
+
+/**
+ * @brief sharedRatioTable: the ratio table of an offset, built on its first use
+ *
+ * The table only depends on v, so the models share one read-only copy of
+ * it instead of 128 KB each. It lives until the program ends.
+ *
+ * @param v: the offset of the luminance ratio
+ *
+ * @return: the 256x256 table of buildRatioTable
+ */
+static const ushort *sharedRatioTable(float v)
+{
+	static std::mutex lock;
+	static map<float, Mat> tables;
+	std::lock_guard<std::mutex> guard(lock);
+	Mat &table = tables[v];
+
+	if( table.empty() )
+		buildRatioTable(table, v);
+	return table.ptr<ushort>();
+}
+
+/**
+ * @brief countChanged: count the pixels of an object that changed since the last frame
+ *
+ * @param objLabel: objects of this frame
+ * @param prevObjLabel: objects of the last frame
+ * @param lumRatio: luminance ratio of this frame
+ * @param prevLumRatio: luminance ratio of the last frame
+ * @param box: box around the object in both frames
+ * @param label: label of the object in this frame
+ * @param prevLabel: label of the object in the last frame
+ * @param mgThr: the minimum gradient threshold of the object, a ratio that moved this much is changed
+ * @param limit: stop counting once the count is over this
+ *
+ * @return: number of pixels that joined or left the object, or whose luminance ratio moved
+ */
+template<typename P, typename T>
+static int countChanged(const Mat &objLabel, const Mat &prevObjLabel, const Mat &lumRatio,
+		const Mat &prevLumRatio, Rect box, int label, int prevLabel, const Vec<T, 3> &mgThr, int limit)
+{
+	int i, j, changed = 0;
+
+	for( i = box.y ; i < box.y+box.height && changed <= limit ; ++i )
+	{
+		const int *obj = objLabel.ptr<int>(i), *prevObj = prevObjLabel.ptr<int>(i);
+		const P *lr = lumRatio.ptr<P>(i), *prevLr = prevLumRatio.ptr<P>(i);
+		for( j = box.x ; j < box.x+box.width ; ++j )
+		{
+			bool in = obj[j] == label, was = prevObj[j] == prevLabel;
+			if( in != was || (in && !isLGCEdge(lr[j], prevLr[j], mgThr)) )
+				++changed;
+		}
 	}
-	return (num+1)/2;
+	return changed;
 }
 
 MCSS::MCSS()
@@ -497,6 +1387,18 @@ MCSS::MCSS()
 	mgThrFixed = DEFAULT_MGTHR_FIXED;
 	isMGThrFixed = true;
 	hasFringe = false;
+	isFixedPoint = false;
+	isIntegerOnly = false;
+	reuseInterval = 0;
+	reuseMaxChange = DEFAULT_REUSE_MAX_CHANGE;
+	pyramidLevels = 0;
+	fgDeviation = DEFAULT_FG_DEVIATION;
+	fgMinDiff = DEFAULT_FG_MIN_DIFF;
+	resultInRegions = false;
+	minObjArea = MIN_OBJ_AREA;
+	fringeRadius = 2;
+	stats = MCSS_Stats();
+	diag = NULL;
 }
 
 /**
@@ -517,6 +1419,13 @@ MCSS_Param MCSS::getParameters()
 	p.mgThrFixed = mgThrFixed;
 	p.isMGThrFixed = isMGThrFixed;
 	p.hasFringe = hasFringe;
+	p.isFixedPoint = isFixedPoint;
+	p.isIntegerOnly = isIntegerOnly;
+	p.reuseInterval = reuseInterval;
+	p.reuseMaxChange = reuseMaxChange;
+	p.pyramidLevels = pyramidLevels;
+	p.fgDeviation = fgDeviation;
+	p.fgMinDiff = fgMinDiff;
 
 	return p;
 }
@@ -537,6 +1446,95 @@ void MCSS::setParameters(MCSS_Param p)
 	mgThrFixed = p.mgThrFixed;
 	isMGThrFixed = p.isMGThrFixed;
 	hasFringe = p.hasFringe;
+	isFixedPoint = p.isFixedPoint || p.isIntegerOnly;
+	isIntegerOnly = p.isIntegerOnly;
+	reuseInterval = p.reuseInterval;
+	reuseMaxChange = p.reuseMaxChange;
+	pyramidLevels = p.pyramidLevels;
+	fgDeviation = p.fgDeviation;
+	fgMinDiff = p.fgMinDiff;
+
+	/* the coarse level of pyramid mode runs with the same parameters on smaller frames */
+	if( pyramidLevels > 0 )
+	{
+		if( coarse.model.empty() )
+		{
+			coarse.model = Ptr<MCSS>(new MCSS);
+			coarse.model->setDiagnostics(diag);
+		}
+		p.pyramidLevels = 0;
+		coarse.model->setParameters(p);
+		/* the objects and the fringe shrink with the frames */
+		coarse.model->minObjArea = max(minObjArea >> 2*pyramidLevels, 1);
+		coarse.model->fringeRadius = fringeRadius >> pyramidLevels;
+	}
+}
+
+/**
+ * @brief getStats: get the timings and counters of the last frame
+ *
+ * @return: the statistics, all zero when built with MCSS_NO_STATS
+ */
+const MCSS_Stats &MCSS::getStats() const
+{
+	return stats;
+}
+
+/**
+ * @brief setDiagnostics: send the intermediate results of each frame to a sink
+ *
+ * @param sink: the sink, NULL (the default) to turn the diagnostics off
+ */
+void MCSS::setDiagnostics(MCSSDiagnostics *sink)
+{
+	diag = sink;
+	/* in pyramid mode they are those of the coarse level */
+	if( !coarse.model.empty() )
+		coarse.model->setDiagnostics(sink);
+}
+
+/**
+ * @brief cloneBuffers: give a copy of a model buffers of its own
+ *
+ * A copied Mat shares its data, so without this a copy would update the
+ * background statistics and the history of the model it was copied from.
+ */
+void MCSS::cloneBuffers()
+{
+	Mat *mats[] = {&lumRatio, &lgcLabel, &bgImage, &fgMask, &objLabel, &cont, &mean, &STD,
+		&history.objLabel, &history.lgcLabel, &history.lumRatio, &scratch.labels, &scratch.objMask,
+		&scratch.post_mask, &scratch.fringe, &scratch.morphMask, &scratch.morphRatio, &scratch.lgcObj,
+		&scratch.pyrCurrent, &scratch.pyrBackground, &scratch.pyrMask, &scratch.pyrEdge};
+	size_t k;
+	/* the result is dst or the caller's mask, which isn't ours to copy */
+	bool isDst = result.data == dst.data;
+
+	for( k = 0 ; k < sizeof(mats)/sizeof(mats[0]) ; ++k )
+		*mats[k] = mats[k]->clone();
+	dst = dst.clone();
+	if( isDst )
+		result = dst;
+}
+
+/**
+ * @brief MCSS_Coarse: copy the coarse model, buffers and all
+ */
+MCSS_Coarse::MCSS_Coarse(const MCSS_Coarse &c)
+{
+	*this = c;
+}
+
+MCSS_Coarse &MCSS_Coarse::operator=(const MCSS_Coarse &c)
+{
+	if( this == &c )
+		return *this;
+	model.release();
+	if( !c.model.empty() )
+	{
+		model = Ptr<MCSS>(new MCSS(*c.model));
+		model->cloneBuffers();
+	}
+	return *this;
 }
 
 /**
@@ -549,9 +1547,78 @@ void MCSS::setParameters(MCSS_Param p)
  */
 void MCSS::operator()(Mat current, Mat background, Mat mask, OutputArray output)
 {
-	Mat post_mask, tmp;
-	int objNum = 0, lgcNum = 0;
-	int i, j;
+	update(current, background, mask, true);
+	writeResult(output);
+}
+
+/**
+ * @brief operator(): update the model and keep the result for the get*Result functions
+ *
+ * @param current: the current frame
+ * @param background: the background image
+ * @param mask: mask image from any BS model
+ */
+void MCSS::operator()(Mat current, Mat background, Mat mask)
+{
+	update(current, background, mask, true);
+}
+
+/**
+ * @brief operator(): update the model on the frame alone
+ *
+ * @param current: the current frame
+ * @param output: the final result mask image
+ */
+void MCSS::operator()(Mat current, OutputArray output)
+{
+	(*this)(current);
+	writeResult(output);
+}
+
+/**
+ * @brief operator(): update the model on the frame alone, keep the result for the get*Result functions
+ *
+ * The built-in background model tests each pixel against the background
+ * statistics (mean and mean absolute deviation of the frames where it was
+ * background) to get the mask, then updates them outside the mask. Its
+ * rounded mean is the background image. The shadow stage then runs on
+ * these, the adaptive minimum gradient threshold uses the same statistics.
+ * Until a pixel has been background once it is taken as background, so
+ * the objects of the first frame are learnt as background.
+ *
+ * @param current: the current frame
+ */
+void MCSS::operator()(Mat current)
+{
+	CV_Assert(current.data != NULL);
+	CV_Assert(current.type() == CV_8UC3);
+	fitStatistics(mean, STD, cont, current.size(), isIntegerOnly);
+	STATS(int64 tick = getTickCount());
+	fgMask.create(current.size(), CV_8UC1);
+	bgImage.create(current.size(), CV_8UC3);
+	parallel_for_(Range(0, current.rows), ForegroundDetector(current, cont, mean, STD, fgMask, bgImage,
+				fgDeviation, fgMinDiff));
+	STATS(double ms = lap(tick));
+	update(current, bgImage, fgMask, false);
+	/* update restarted the statistics, the background model counts as background statistics */
+	STATS(stats.stageTime[STAGE_BACKGROUND] += ms);
+	STATS(stats.frameTime += ms);
+}
+
+/**
+ * @brief update: update the model
+ *
+ * @param current: the current frame
+ * @param background: the background image
+ * @param mask: mask image from any BS model
+ * @param updateBackground: false if the built-in background model has updated the statistics
+ */
+void MCSS::update(Mat current, Mat background, Mat mask, bool updateBackground)
+{
+	Mat post_mask;
+	const vector<Rect> &regions = scratch.regions;
+	int objNum = 0, lgcNum = 0, newLgcNum, reusedNum;
+	int i, j, k, n;
 
 	CV_Assert(current.data != NULL);
 	CV_Assert(background.data != NULL);
@@ -559,6 +1626,13 @@ void MCSS::operator()(Mat current, Mat background, Mat mask, OutputArray output)
 	CV_Assert(current.type() == CV_8UC3);
 	CV_Assert(background.type() == CV_8UC3);
 	CV_Assert(mask.type() == CV_8UC1);
+	if( pyramidLevels > 0 )
+	{
+		runPyramid(current, background, mask);
+		return;
+	}
+	STATS(int64 frameTick = getTickCount(), tick = frameTick);
+	STATS(stats = MCSS_Stats());
 
 	++nframes;
 	if( nframes == 1 )
@@ -566,90 +1640,180 @@ void MCSS::operator()(Mat current, Mat background, Mat mask, OutputArray output)
 		frameSize = mask.size();
 		frameType = mask.type();
 
-		mean = Mat::zeros(mask.size(), CV_32FC3);
-		STD = Mat::zeros(mask.size(), CV_32FC3);
-		cont = Mat::zeros(mask.size(), CV_8UC1);
-		objLabel = Mat::zeros(mask.size(), CV_8UC1);
-		lgcLabel = Mat::zeros(mask.size(), CV_16UC1);
-		lumRatio = Mat::zeros(mask.size(), CV_32FC3);
-		lgcImg = Mat::zeros(mask.size(), CV_8UC3);
+		objLabel = Mat::zeros(mask.size(), CV_32SC1);
+		lgcLabel = Mat::zeros(mask.size(), CV_32SC1);
 		dst = Mat::zeros(mask.size(), CV_8UC1);
+
+		/* size the scratch memory once */
+		scratch.labels.create(mask.size(), CV_32SC1);
+		scratch.objMask = Mat::zeros(mask.size(), CV_8UC1);
+		scratch.post_mask = Mat::zeros(mask.size(), CV_8UC1);
+		scratch.fringe = Mat::zeros(mask.size(), CV_8UC1);
+		scratch.lgcObj = Mat::zeros(mask.size(), CV_32SC1);
+		scratch.morphMask.create(mask.size(), CV_8UC1);
+		scratch.parent.reserve(RESERVED_LABELS);
+		scratch.area.reserve(RESERVED_LABELS);
+		scratch.remap.reserve(RESERVED_LABELS);
+		scratch.box.reserve(RESERVED_LABELS);
+		scratch.blobBox.reserve(RESERVED_LABELS);
+		scratch.regions.reserve(RESERVED_LABELS);
+		scratch.rowStart.reserve(mask.rows+1);
+		/* a few regions crossing each row */
+		scratch.rowRegions.reserve(4*mask.rows);
+		objArea.reserve(RESERVED_OBJECTS);
+		objBox.reserve(RESERVED_OBJECTS);
+		mean_average_bg.reserve(RESERVED_OBJECTS);
+		standard_deviation_average_bg.reserve(RESERVED_OBJECTS);
+		mgThr.reserve(RESERVED_OBJECTS);
+		scratch.fixedMGThr.reserve(RESERVED_OBJECTS);
+		scratch.bgSumStart.reserve(RESERVED_OBJECTS);
+		scratch.splitRows.reserve(RESERVED_OBJECTS);
+		scratch.lgcOffset.reserve(RESERVED_OBJECTS);
+		scratch.pieces.reserve(RESERVED_OBJECTS);
+		scratch.batches.reserve(RESERVED_OBJECTS);
+		/* the batches aim at OBJECT_TASK_PIXELS, a frame seldom has more than this */
+		scratch.lgcTables.resize(frameSize.area()/OBJECT_TASK_PIXELS+1);
+		for( k = 0 ; k < (int)scratch.lgcTables.size() ; ++k )
+			reserveTable(scratch.lgcTables[k], RESERVED_BATCH_LGCS, RESERVED_BATCH_LGCS);
+		/* 6 sums for each band an object's box crosses */
+		scratch.bgSum.reserve(16*RESERVED_OBJECTS);
+		scratch.bgSumFixed.reserve(16*RESERVED_OBJECTS);
+		scratch.reuse.reserve(RESERVED_OBJECTS);
+		scratch.reuseOwner.reserve(RESERVED_OBJECTS);
+		scratch.objAge.reserve(RESERVED_OBJECTS);
+		history.regions.reserve(RESERVED_LABELS);
+		history.objBox.reserve(RESERVED_OBJECTS);
+		history.objAge.reserve(RESERVED_OBJECTS);
+		lgcArea.reserve(RESERVED_LGCS);
+		lgcToObj.reserve(RESERVED_LGCS);
+		meanLGC.reserve(RESERVED_LGCS);
+		tpw.reserve(RESERVED_LGCS);
+		lgcIsShadow.reserve(RESERVED_LGCS);
+		scratch.external.reserve(RESERVED_LGCS);
+		scratch.all.reserve(RESERVED_LGCS);
+		scratch.lgcSum.reserve(3*RESERVED_LGCS);
+		scratch.reuseFrom.reserve(RESERVED_LGCS);
+		history.lgcArea.reserve(RESERVED_LGCS);
+		history.lgcToObj.reserve(RESERVED_LGCS);
+		history.meanLGC.reserve(RESERVED_LGCS);
+		history.isShadow.reserve(RESERVED_LGCS);
+		history.external.reserve(RESERVED_LGCS);
+		history.all.reserve(RESERVED_LGCS);
+	}
+	/* the built-in background model may have started them */
+	fitStatistics(mean, STD, cont, frameSize, isIntegerOnly);
+	/* the type of lumRatio follows the mode, which may change between frames */
+	if( lumRatio.type() != (isFixedPoint ? CV_16UC3 : CV_32FC3) )
+	{
+		lumRatio = Mat::zeros(frameSize, isFixedPoint ? CV_16UC3 : CV_32FC3);
+		scratch.morphRatio.create(frameSize, lumRatio.type());
 	}
-	/* initialize everything */
-	objLabel *= 0;
-	lgcLabel *= 0;
-	lumRatio *= 0;
-	dst *= 0;
-	lgcImg *= 0;
+	if( isFixedPoint && scratch.ratioTable == NULL )
+		scratch.ratioTable = sharedRatioTable(v);
+	/* 
+	 * initialize everything, only the regions of the last frame
+	 * can be non zero
+	 * */
+	clearRegions(objLabel, regions);
+	clearRegions(lgcLabel, regions);
+	clearRegions(lumRatio, regions);
+	clearRegions(dst, regions);
+	clearRegions(scratch.objMask, regions);
+	clearRegions(scratch.post_mask, regions);
+	clearRegions(scratch.fringe, regions);
+	scratch.regions.clear();
 	mean_average_bg.clear();
 	standard_deviation_average_bg.clear();
 	mgThr.clear();
 	objArea.clear();
+	objBox.clear();
 	lgcArea.clear();
 	tpw.clear();
 	lgcIsShadow.clear();
 	lgcToObj.clear();
 	meanLGC.clear();
 
-	cerr << endl << "frame " << nframes << endl;
-
 	/* detect foreground objects */
 	// threshold(mask, mask, 30, 255, CV_THRESH_BINARY);
-	bool detectObj = true;
-	tmp.create(mask.size(), CV_8UC1);
-	tmp *= 0;
-	for( i = 0 ; i < mask.rows && detectObj ; ++i )
-	{
-		for( j = 0 ; j < mask.cols && detectObj ; ++j )
-		{
-			/* 
-			 * if point (i, j) belongs to background
-			 * or has been labeled already, just
-			 * ignore it
-			 * */
-			if( mask.at<uchar>(i, j) == 0 || objLabel.at<uchar>(i, j) != 0 || tmp.at<uchar>(i, j) != 0 )
-				continue;
-			else
-				tmp.at<uchar>(i, j) = 1;
-			if( objNum >= MAX_OBJ_NUM )
-				detectObj = false;
-			int area;
-			area = findRegion(mask, objLabel, Point(i, j), objNum+1);
-			/* eliminate small regions */
-			if( area < MIN_OBJ_AREA )
-			{
-				cleanRegionU8(objLabel, Point(i, j), objNum+1, 0);
-				continue;
-			}
-			++objNum;
-			// cerr << "Get one object :" << objNum << endl << "Area: " << area << endl;
-			objArea.push_back(area);
-			mean_average_bg.push_back(0);
-			standard_deviation_average_bg.push_back(0);
-			mgThr.push_back(Vec3f(0, 0, 0));
-		}
-	}
+	objNum = labelObjects(mask, objLabel, objArea, objBox, minObjArea, scratch);
+#ifndef MCSS_NO_STATS
+	stats.objects = objNum;
+	stats.rejectedObjects = scratch.blobBox.size()-objNum;
+	stats.visitedPixels = mask.total();
+	stats.peakLabels = scratch.parent.size()-1;
+#endif
+	mean_average_bg.assign(objNum, Vec3f(0, 0, 0));
+	standard_deviation_average_bg.assign(objNum, Vec3f(0, 0, 0));
+	mgThr.assign(objNum, Vec3f(0, 0, 0));
 	if( objNum == 0 )
 	{
-		mask.copyTo(output);
+		result = mask;
+		resultInRegions = false;
+		if( reuseInterval > 0 )
+			saveHistory();
+		STATS(stats.stageTime[STAGE_OBJECTS] = lap(tick));
+		STATS(stats.frameTime = lap(frameTick));
+		if( diag != NULL )
+			publishDiagnostics();
 		return;
 	}
+	/* 
+	 * the passes below run inside the regions around the objects, only the
+	 * background statistics still cover the whole frame. Without
+	 * the fringe removal the rejected blobs keep their mask value and may
+	 * still become shadow like pixels, so they get a region too.
+	 * */
+	buildRegions(hasFringe ? objBox : scratch.blobBox, frameSize, scratch);
+	/* the 8-bit mask of the objects, for the erosion and the background update */
+	for( k = 0 ; k < (int)regions.size() ; ++k )
+	{
+		const Rect &r = regions[k];
+		for( i = r.y ; i < r.y+r.height ; ++i )
+		{
+			const int *obj = objLabel.ptr<int>(i);
+			uchar *om = scratch.objMask.ptr<uchar>(i);
+			for( j = r.x ; j < r.x+r.width ; ++j )
+				om[j] = obj[j] != 0 ? 255 : 0;
+		}
+	}
 	if( hasFringe )
 	{
 		/* 
 		 * if the narrow bright fringe exist, try to avoid them 
 		 * (F. Edge Noise Correction)
+		 * the caller's mask is left untouched, the objects are drawn in our own buffer
 		 * */
-		threshold(objLabel*2, mask, 1, 255, CV_THRESH_BINARY);
-		// GaussianBlur(mask, mask, Size(5, 5), 0, 0);
-		threshold(mask, mask, 10, 255, CV_THRESH_BINARY);
-		erode(mask, post_mask, getStructuringElement(MORPH_RECT, Size(5, 5)), Point(-1, -1), 1);
-		threshold(post_mask, post_mask, 254, 255, CV_THRESH_BINARY);
+		post_mask = scratch.post_mask;
+		for( k = 0 ; k < (int)regions.size() ; ++k )
+		{
+			// GaussianBlur(objMask, objMask, Size(5, 5), 0, 0);
+			morphRegion<uchar>(scratch.objMask, post_mask, scratch.morphMask, regions[k], fringeRadius, false);
+		}
+		/* the objects within the eroded mask, what the erosion took is the fringe */
+		for( k = 0 ; k < (int)regions.size() ; ++k )
+		{
+			const Rect &r = regions[k];
+			for( i = r.y ; i < r.y+r.height ; ++i )
+			{
+				int *obj = objLabel.ptr<int>(i);
+				const uchar *post = post_mask.ptr<uchar>(i);
+				uchar *om = scratch.objMask.ptr<uchar>(i), *fr = scratch.fringe.ptr<uchar>(i);
+				for( j = r.x ; j < r.x+r.width ; ++j )
+				{
+					if( post[j] == 0 )
+					{
+						fr[j] = om[j];
+						obj[j] = om[j] = 0;
+					}
+				}
+			}
+		}
 	}
+	/* the objects come from the caller's mask, they are all within it */
 	else
-		mask.copyTo(post_mask);
-	objLabel &= post_mask;
+		post_mask = mask;
 	// cerr << "Get " << objNum << " foreground objects" << endl;
+	STATS(stats.stageTime[STAGE_OBJECTS] = lap(tick));
 
 
 	/* 
@@ -659,63 +1823,82 @@ void MCSS::operator()(Mat current, Mat background, Mat mask, OutputArray output)
 	 * */
 	if( !isMGThrFixed )
 	{
-		/* calculate the mean value(time sequence), variance of each object */
-		for( i = 0 ; i < objLabel.rows ; ++i )
+		/* 
+		 * update the mean value(time sequence) and the deviation of the
+		 * background pixels, and sum them over each object
+		 * */
+		int bandNum = (frameSize.height+BACKGROUND_BAND_ROWS-1)/BACKGROUND_BAND_ROWS;
+		vector<double> &bgSum = scratch.bgSum;
+		vector<int> &bgSumStart = scratch.bgSumStart;
+		/* each object only has sums for the bands its box crosses */
+		bgSumStart.resize(objNum);
+		for( i = n = 0 ; i < objNum ; ++i )
 		{
-			for( j = 0 ; j < objLabel.cols ; ++j )
-			{
-				if( objLabel.at<uchar>(i, j) != 0 )
-					continue;
-				uchar b, g, r;
-				int n = cont.at<uchar>(i, j)+1;
-				if( n < HISTORY )
-					cont.at<uchar>(i, j) += 1;
-				b = current.at<Vec3b>(i, j)[0];
-				g = current.at<Vec3b>(i, j)[1];
-				r = current.at<Vec3b>(i, j)[2];
-				mean.at<Vec3f>(i, j)[0] = (n-1)*(mean.at<Vec3f>(i, j)[0])/n+b/n;
-				mean.at<Vec3f>(i, j)[1] = (n-1)*(mean.at<Vec3f>(i, j)[1])/n+g/n;
-				mean.at<Vec3f>(i, j)[2] = (n-1)*(mean.at<Vec3f>(i, j)[2])/n+r/n;
-				STD.at<Vec3f>(i, j)[0] = (n-1)*STD.at<Vec3f>(i, j)[0]/n+abs(b-mean.at<Vec3f>(i, j)[0])/n;
-				STD.at<Vec3f>(i, j)[1] = (n-1)*STD.at<Vec3f>(i, j)[1]/n+abs(g-mean.at<Vec3f>(i, j)[1])/n;
-				STD.at<Vec3f>(i, j)[2] = (n-1)*STD.at<Vec3f>(i, j)[2]/n+abs(r-mean.at<Vec3f>(i, j)[2])/n;
-			}
+			bgSumStart[i] = n;
+			n += ((objBox[i].y+objBox[i].height-1)/BACKGROUND_BAND_ROWS-objBox[i].y/BACKGROUND_BAND_ROWS+1)*6;
 		}
-
-
-		/* calculate the sum of each pixel's mean and standard deviation */
-		for( i = 0 ; i < post_mask.rows ; ++i )
+		if( isIntegerOnly )
 		{
-			for( j = 0 ; j < post_mask.cols ; ++j )
-			{
-				if( objLabel.at<uchar>(i, j) == 0 )
-					continue;
-				mean_average_bg[objLabel.at<uchar>(i, j)-1][0] += mean.at<Vec3f>(i, j)[0];
-				mean_average_bg[objLabel.at<uchar>(i, j)-1][1] += mean.at<Vec3f>(i, j)[1];
-				mean_average_bg[objLabel.at<uchar>(i, j)-1][2] += mean.at<Vec3f>(i, j)[2];
-				standard_deviation_average_bg[objLabel.at<uchar>(i, j)-1][0] += STD.at<Vec3f>(i, j)[0];
-				standard_deviation_average_bg[objLabel.at<uchar>(i, j)-1][1] += STD.at<Vec3f>(i, j)[1];
-				standard_deviation_average_bg[objLabel.at<uchar>(i, j)-1][2] += STD.at<Vec3f>(i, j)[2];
-			}
+			growCapacity(scratch.bgSumFixed, n);
+			scratch.bgSumFixed.assign(n, 0);
+			parallel_for_(Range(0, bandNum), BackgroundUpdater<short, long long>(current, objLabel, cont,
+						mean, STD, updateBackground, objBox, &scratch.bgSumFixed[0], scratch));
 		}
-		for( i = 0 ; i < (int)mean_average_bg.size() ; ++i )
+		else
 		{
-			mean_average_bg[i][0] /= objArea[i];
-			mean_average_bg[i][1] /= objArea[i];
-			mean_average_bg[i][2] /= objArea[i];
-			standard_deviation_average_bg[i][0] /= objArea[i];
-			standard_deviation_average_bg[i][1] /= objArea[i];
-			standard_deviation_average_bg[i][2] /= objArea[i];
+			growCapacity(bgSum, n);
+			bgSum.assign(n, 0.0);
+			parallel_for_(Range(0, bandNum), BackgroundUpdater<float, double>(current, objLabel, cont,
+						mean, STD, updateBackground, objBox, &bgSum[0], scratch));
 		}
-	}
-
-
-	/* get the minimum gradient threshold for each object */
-	for( i = 0 ; i < (int)mgThr.size() ; ++i )
-	{
-		if( !isMGThrFixed )
+		/* 
+		 * alpha*mean*STD has 2*BG_FIXED_SHIFT+ALPHA_FIXED_SHIFT fractional
+		 * bits, under 2^62 as long as alpha < 4
+		 * */
+		long long fixedAlpha = (long long)(alpha*(double)(1LL << ALPHA_FIXED_SHIFT)+0.5);
+		const int mgThrShift = 2*BG_FIXED_SHIFT+ALPHA_FIXED_SHIFT-LUMRATIO_FIXED_SHIFT;
+		scratch.fixedMGThr.resize(objNum);
+		for( i = 0 ; i < objNum ; ++i )
 		{
-			mgThr[i][0] = alpha*mean_average_bg[i][0]*standard_deviation_average_bg[i][0];
+			int len = (i+1 < objNum ? bgSumStart[i+1] : n)-bgSumStart[i];
+			if( isIntegerOnly )
+			{
+				/* mgThr straight in the fixed point of the luminance ratio, rounded up */
+				long long *sum = &scratch.bgSumFixed[bgSumStart[i]];
+				for( k = 6 ; k < len ; ++k )
+					sum[k%6] += sum[k];
+				for( j = 0 ; j < 3 ; ++j )
+				{
+					long long m = sum[j]/objArea[i], sd = sum[3+j]/objArea[i];
+					scratch.fixedMGThr[i][j] = (int)((fixedAlpha*m*sd+(1LL << mgThrShift)-1) >> mgThrShift);
+				}
+				continue;
+			}
+			/* the bands in order, so the sums don't depend on the threads */
+			double *sum = &bgSum[bgSumStart[i]];
+			for( k = 6 ; k < len ; ++k )
+				sum[k%6] += sum[k];
+			for( j = 0 ; j < 3 ; ++j )
+			{
+				mean_average_bg[i][j] = (float)(sum[j]/objArea[i]);
+				standard_deviation_average_bg[i][j] = (float)(sum[3+j]/objArea[i]);
+			}
+		}
+	}
+
+
+	/* get the minimum gradient threshold for each object */
+	for( i = 0 ; i < (int)mgThr.size() ; ++i )
+	{
+		if( !isMGThrFixed && isIntegerOnly )
+		{
+			/* only for the diagnostics, the search reads fixedMGThr */
+			for( j = 0 ; j < 3 ; ++j )
+				mgThr[i][j] = scratch.fixedMGThr[i][j]/(float)(1 << LUMRATIO_FIXED_SHIFT);
+		}
+		else if( !isMGThrFixed )
+		{
+			mgThr[i][0] = alpha*mean_average_bg[i][0]*standard_deviation_average_bg[i][0];
 			mgThr[i][1] = alpha*mean_average_bg[i][1]*standard_deviation_average_bg[i][1];
 			mgThr[i][2] = alpha*mean_average_bg[i][2]*standard_deviation_average_bg[i][2];
 		}
@@ -723,207 +1906,164 @@ void MCSS::operator()(Mat current, Mat background, Mat mask, OutputArray output)
 			mgThr[i] = mgThrFixed;
 	}
 
-#ifdef debug
-	for( i = 0 ; i < (int)mgThr.size() ; ++i )
-	{
-		cerr << "mean_average_bg[" << i << "] = " << mean_average_bg[i][0] << " " << mean_average_bg[i][1] << " " << mean_average_bg[i][2] << endl;
-		cerr << "standard_deviation_average_bg[" << i << "] = " << standard_deviation_average_bg[i][0] << " " << standard_deviation_average_bg[i][1] << " " << standard_deviation_average_bg[i][2] << endl;
-		cerr << "mgThr[" << i << "] = " << mgThr[i][0] << " " << mgThr[i][1] << " " << mgThr[i][2] << endl;
-	}
-#endif
+	STATS(stats.stageTime[STAGE_BACKGROUND] = lap(tick));
 
 	/* 
 	 * get the luminance ratio
 	 * (Part III. MOVING SHADOW DETECTION ,C. Regions with Local Color Constancy)
 	 * */
-	post_mask.copyTo(dst);
-	for( i = 0 ; i < post_mask.rows ; ++i )
+	for( k = 0 ; k < (int)regions.size() ; ++k )
 	{
-		for( j = 0 ; j < post_mask.cols ; ++j )
+		const Rect &r = regions[k];
+		for( i = r.y ; i < r.y+r.height ; ++i )
 		{
-			if( post_mask.at<uchar>(i, j) != 255 )
-			{
-				// dst.at<uchar>(i, j) = 1;
-				continue;
-			}
-			lumRatio.at<Vec3f>(i, j)[0] = (background.at<Vec3b>(i, j)[0]+v)/(current.at<Vec3b>(i, j)[0]+v);
-			lumRatio.at<Vec3f>(i, j)[1] = (background.at<Vec3b>(i, j)[1]+v)/(current.at<Vec3b>(i, j)[1]+v);
-			lumRatio.at<Vec3f>(i, j)[2] = (background.at<Vec3b>(i, j)[2]+v)/(current.at<Vec3b>(i, j)[2]+v);
-			/* Shadow like area */
-			if( ((lumRatio.at<Vec3f>(i, j))[0] >= 1) &&
-					((lumRatio.at<Vec3f>(i, j))[1] >= 1) &&
-					((lumRatio.at<Vec3f>(i, j))[2] >= 1))
-				dst.at<uchar>(i, j) = 127;
-			/* foreground pixel */
+			const uchar *cur = current.ptr<uchar>(i)+3*r.x, *bg = background.ptr<uchar>(i)+3*r.x;
+			if( isFixedPoint )
+				lumRatioRowLUT(cur, bg, post_mask.ptr<uchar>(i)+r.x, scratch.ratioTable,
+						lumRatio.ptr<ushort>(i)+3*r.x, dst.ptr<uchar>(i)+r.x, r.width);
 			else
-			{
-				lumRatio.at<Vec3f>(i, j)[0] = 0;
-				lumRatio.at<Vec3f>(i, j)[1] = 0;
-				lumRatio.at<Vec3f>(i, j)[2] = 0;
-				dst.at<uchar>(i, j) = 255;
-			}
+				lumRatioRow(cur, bg, post_mask.ptr<uchar>(i)+r.x, v,
+						lumRatio.ptr<float>(i)+3*r.x, dst.ptr<uchar>(i)+r.x, r.width);
 		}
 	}
 	// threshold(lumRatio, lumRatio, 50, 0, CV_THRESH_TOZERO_INV);
 
-#ifdef debug
-	tmp = lumRatio;
-	dilate(tmp, tmp, Mat(), Point(-1, -1), 1);
-	erode(tmp, tmp, Mat(), Point(-1, -1), 1);
-	tmp.convertTo(tmp, CV_8UC3, 1, 0);
-	imshow("lumRatio", tmp*30);
-#endif
-	/* search the local gradient constancy */
-	bool detectLGC = true;
-	for( i = 0 ; i < post_mask.rows && detectLGC ; ++i )
+	/* close the small holes of the luminance ratio */
+	for( k = 0 ; k < (int)regions.size() ; ++k )
 	{
-		for( j = 0 ; j < post_mask.cols && detectLGC ; ++j )
+		/* the margin keeps the ratio zero around the region, so it closes like the whole frame */
+		if( isFixedPoint )
 		{
-			if( objLabel.at<uchar>(i, j) == 0 || lgcLabel.at<ushort>(i, j) != 0 || lumRatio.at<Vec3f>(i, j) == Vec3f(0, 0, 0) )
-				continue;
-			if( mgThr[objLabel.at<uchar>(i, j)-1][0] == 0 &&  mgThr[objLabel.at<uchar>(i, j)-1][1] == 0 && mgThr[objLabel.at<uchar>(i, j)-1][2] == 0 )
-			{
-				lgcLabel.at<ushort>(i, j) = SMALL_LGC_LABEL;
-				continue;
-			}
-			/* limit the max number of LGC regions */
-			if( lgcNum >= MAX_LGC_NUM )
-				detectLGC = false;
-			int area;
-			area = findLGC(objLabel, lumRatio, lgcLabel, Point(i, j), lgcNum+1, mgThr[objLabel.at<uchar>(i, j)-1], threshold1, threshold2);
-			/* label each of the small region to a fixed number */
-			if( area < MIN_LGC_AREA )
-			{
-				cleanRegionU16(lgcLabel, Point(i, j), lgcNum+1, SMALL_LGC_LABEL);
-				continue;
-			}
-			++lgcNum;
-			// cerr << "Get one lgc :" << lgcNum-1 << "Area: " << area << endl; 
-			lgcArea.push_back(area);
-			lgcToObj.push_back(objLabel.at<uchar>(i, j));
-			meanLGC.push_back(0);
-			tpw.push_back(0);
-			lgcIsShadow.push_back(true);
+			morphRegion<ushort>(lumRatio, lumRatio, scratch.morphRatio, regions[k], 1, true);
+			morphRegion<ushort>(lumRatio, lumRatio, scratch.morphRatio, regions[k], 1, false);
 		}
-	}
-	if( lgcNum == 0 )
-	{
-		post_mask.copyTo(output);
-		return;
-	}
-
-#ifdef debug
-	{
-		/* draw the LGC area */
-		for( i = 0 ; i < post_mask.rows && detectLGC ; ++i )
+		else
 		{
-			for( j = 0 ; j < post_mask.cols && detectLGC ; ++j )
-			{
-				if( lgcLabel.at<ushort>(i, j) == 0 )
-				{
-					lgcImg.at<Vec3b>(i, j)[0] = 0;
-					lgcImg.at<Vec3b>(i, j)[1] = 0;
-					lgcImg.at<Vec3b>(i, j)[2] = 0;
-					continue;
-				}
-				else if( lgcLabel.at<ushort>(i, j) == SMALL_LGC_LABEL )
-				{
-					lgcImg.at<Vec3b>(i, j)[0] = 255;
-					lgcImg.at<Vec3b>(i, j)[1] = 255;
-					lgcImg.at<Vec3b>(i, j)[2] = 255;
-					continue;
-				}
-				lgcImg.at<Vec3b>(i, j) = Vec3b( (lgcLabel.at<ushort>(i, j))%5*50+50, 205-(lgcLabel.at<ushort>(i, j))%5*50, (lgcLabel.at<ushort>(i, j))%5*50+50);
-			}
+			morphRegion<float>(lumRatio, lumRatio, scratch.morphRatio, regions[k], 1, true);
+			morphRegion<float>(lumRatio, lumRatio, scratch.morphRatio, regions[k], 1, false);
 		}
-		imshow("lgcImg", lgcImg);
 	}
-	cerr << "Get " << lgcNum << " lgc regions" << endl;
-#endif
-
+	STATS(stats.stageTime[STAGE_LUMRATIO] = lap(tick));
 	/* 
-	 * calculate the mean value of each LGC
-	 * (Part III. MOVING SHADOW DETECTION, E. Classification Process)
+	 * the thresholds in the same fixed point, mgThr is rounded up so
+	 * that a non zero threshold stays non zero. The integer only mode has
+	 * computed the adaptive one already.
 	 * */
-	for( i = 0 ; i < post_mask.rows ; ++i )
+	const float scale = 1 << LUMRATIO_FIXED_SHIFT;
+	if( isFixedPoint && (isMGThrFixed || !isIntegerOnly) )
 	{
-		for( j = 0 ; j < post_mask.cols ; ++j )
+		vector<Vec3i> &fixedMGThr = scratch.fixedMGThr;
+		fixedMGThr.resize(mgThr.size());
+		for( i = 0 ; i < (int)mgThr.size() ; ++i )
 		{
-			if( lgcLabel.at<ushort>(i, j) == 0 || lgcLabel.at<ushort>(i, j) == SMALL_LGC_LABEL )
-				continue;
-			float b = (lumRatio.at<Vec3f>(i, j))[0];
-			float g = (lumRatio.at<Vec3f>(i, j))[1];
-			float r = (lumRatio.at<Vec3f>(i, j))[2];
-			meanLGC[lgcLabel.at<ushort>(i, j)-1][0] += b/lgcArea[lgcLabel.at<ushort>(i, j)-1];
-			meanLGC[lgcLabel.at<ushort>(i, j)-1][1] += g/lgcArea[lgcLabel.at<ushort>(i, j)-1];
-			meanLGC[lgcLabel.at<ushort>(i, j)-1][2] += r/lgcArea[lgcLabel.at<ushort>(i, j)-1];
+			fixedMGThr[i][0] = cvCeil(mgThr[i][0]*scale);
+			fixedMGThr[i][1] = cvCeil(mgThr[i][1]*scale);
+			fixedMGThr[i][2] = cvCeil(mgThr[i][2]*scale);
 		}
 	}
 
-	/*
-	 * calculate the number of external terminal pixels and all terminal pixels
-	 * (Part III. MOVING SHADOW DETECTION, E. Classification Process)
-	 * */
-	vector<int> external(lgcNum), all(lgcNum);
-	for( i = 0 ; i < post_mask.rows ; ++i )
+	/* the objects that barely changed keep their LGCs, the search skips them */
+	Mat lgcObj = objLabel;
+	reusedNum = reuseInterval > 0 ? findReusable() : 0;
+	STATS(stats.reusedObjects = reusedNum);
+	if( reusedNum > 0 )
 	{
-		for( j = 0 ; j < post_mask.cols ; ++j )
+		lgcObj = scratch.lgcObj;
+		for( k = 0 ; k < (int)regions.size() ; ++k )
+			objLabel(regions[k]).copyTo(lgcObj(regions[k]));
+		for( k = 0 ; k < objNum ; ++k )
 		{
-			int lgc, obj;
-			lgc = lgcLabel.at<ushort>(i, j);
-			obj = objLabel.at<uchar>(i, j);
-			if( lgc == 0 || lgc == SMALL_LGC_LABEL )
+			if( scratch.reuse[k] < 0 )
 				continue;
-			if( (i>0 && (lgc != lgcLabel.at<ushort>(i-1, j))) ||
-					(j>0 && (lgc != lgcLabel.at<ushort>(i, j-1)))	||
-					(i<post_mask.rows-1 && (lgc != lgcLabel.at<ushort>(i+1, j))) ||
-					(j<post_mask.cols-1 && (lgc != lgcLabel.at<ushort>(i, j+1))) ||
-					((i>0 && (j<post_mask.cols-1)) && (lgc != lgcLabel.at<ushort>(i-1, j+1))) ||
-					((i>0 && j>0) && (lgc != lgcLabel.at<ushort>(i-1, j-1))) ||
-					(((i<post_mask.rows-1) && (j<post_mask.cols-1)) && (lgc != lgcLabel.at<ushort>(i+1, j+1))) ||
-					(((i<post_mask.rows-1) && j>0) && (lgc != lgcLabel.at<ushort>(i+1, j-1))) )
+			const Rect &r = objBox[k];
+			for( i = r.y ; i < r.y+r.height ; ++i )
 			{
-				++all[lgc-1];
-				/* check external terminal pixels */
-				if( (i>0 && (obj != objLabel.at<uchar>(i-1, j))) ||
-						(j>0 && (obj != objLabel.at<uchar>(i, j-1))) ||
-						((i<post_mask.rows-1) && (obj != objLabel.at<uchar>(i+1, j))) ||
-						((j<post_mask.cols-1) && (obj != objLabel.at<uchar>(i, j+1))) ||
-						((i>0 && (j<post_mask.cols-1)) && (obj != objLabel.at<uchar>(i-1, j+1))) ||
-						((i>0 && j>0) && (obj != objLabel.at<uchar>(i-1, j-1))) ||
-						(((i<post_mask.rows-1) && (j<post_mask.cols-1)) && (obj != objLabel.at<uchar>(i+1, j+1))) ||
-						(((i<post_mask.rows-1) && j>0) && (obj != objLabel.at<uchar>(i+1, j-1))) )
-					++external[lgc-1];
+				int *obj = lgcObj.ptr<int>(i);
+				for( j = r.x ; j < r.x+r.width ; ++j )
+				{
+					if( obj[j] == k+1 )
+						obj[j] = 0;
+				}
 			}
 		}
 	}
+	STATS(stats.stageTime[STAGE_LGC] += lap(tick));
+
+	/* search the local gradient constancy */
+	if( isFixedPoint )
+		lgcNum = labelLGC<Vec3w, int>(lgcObj, lumRatio, lgcLabel, scratch.fixedMGThr,
+				cvRound(threshold1*scale), cvRound(threshold2*scale), objBox, lgcArea, lgcToObj, meanLGC,
+				scratch, stats);
+	else
+		lgcNum = labelLGC<Vec3f, float>(lgcObj, lumRatio, lgcLabel, mgThr, threshold1, threshold2,
+				objBox, lgcArea, lgcToObj, meanLGC, scratch, stats);
+	/* labelLGC timed its own stages */
+	STATS(tick = getTickCount());
+	newLgcNum = lgcNum;
+	if( reusedNum > 0 )
+		lgcNum += reuseLGC(newLgcNum);
+	STATS(stats.lgcs = lgcNum);
+	STATS(stats.stageTime[STAGE_LGC] += lap(tick));
+	tpw.assign(lgcNum, 0);
+	lgcIsShadow.assign(lgcNum, true);
+	if( lgcNum == 0 )
+	{
+		/* the eroded mask is ours and zero outside the regions, the caller's is not */
+		if( hasFringe )
+			parallel_for_(Range(0, regions.size()), FringeCorrector(post_mask, scratch.fringe, scratch.labels,
+						regions));
+		result = post_mask;
+		resultInRegions = hasFringe;
+		if( reuseInterval > 0 )
+			saveHistory();
+		STATS(stats.frameTime = lap(frameTick));
+		if( diag != NULL )
+			publishDiagnostics();
+		return;
+	}
 
-	for( i = 0 ; i < lgcNum; ++i )
+
+	/* the terminal pixels were counted by labelLGC */
+	const vector<int> &external = scratch.external, &all = scratch.all;
+	const vector<long long> &lgcSum = scratch.lgcSum;
+	/* the integer only mode tests the counts, the weights are only for the diagnostics */
+	for( i = 0 ; i < lgcNum && (!isIntegerOnly || diag != NULL) ; ++i )
 	{
 		if( external[i] != 0 && all[i] != 0 )
 			tpw[i] = 1.0*external[i]/all[i];
 		else
 			tpw[i] = 0;
-#ifdef debug
-		cerr << "meanLGC[" << i << "] = [" << meanLGC[i][0] << " " << meanLGC[i][1] << " " << meanLGC[i][2] << "]" << " tpw[" << i << "] = " << tpw[i] << "(external, all)" << external[i] << " " << all[i] << " lgcArea = " << lgcArea[i] << endl;
-#endif
 	}
 
-	/* check if each lgc belongs to shadow */
-	for( i = 0 ; i < lgcNum ; ++i )
+	/* check if each lgc belongs to shadow, the reused ones keep their decision */
+	long long fixedTao = cvRound(tao*(1 << RATIO_FIXED_SHIFT));
+	long long fixedLambda = cvRound(lambda_low*(1 << RATIO_FIXED_SHIFT));
+	for( i = newLgcNum ; i < lgcNum ; ++i )
+		lgcIsShadow[i] = history.isShadow[scratch.reuseFrom[i-newLgcNum]];
+	for( i = 0 ; i < newLgcNum ; ++i )
 	{
 		lgcIsShadow[i] = true;
-		if( (meanLGC[i][0] < 1) || (meanLGC[i][1] < 1) || (meanLGC[i][2] < 1))
+		bool dark;
+		if( isFixedPoint )
+		{
+			/* meanLGC < 1 on the integer sums */
+			long long one = (long long)lgcArea[i] << LUMRATIO_FIXED_SHIFT;
+			dark = lgcSum[3*i] < one || lgcSum[3*i+1] < one || lgcSum[3*i+2] < one;
+		}
+		else
+			dark = (meanLGC[i][0] < 1) || (meanLGC[i][1] < 1) || (meanLGC[i][2] < 1);
+		if( dark )
 		{
 			// cerr << "lgc " << i << " is shadow = false: " << 1 << endl;
 			lgcIsShadow[i] = false;
 		}
-		else if( tpw[i] < tao )
+		else if( isIntegerOnly ? isBelowRatio(external[i], all[i], fixedTao) : tpw[i] < tao )
 		{
 			// cerr << "lgc " << i << " is shadow = false: " << 2 << endl;
 			lgcIsShadow[i] = false;
 		}
-		else if( lgcArea[i] < objArea[lgcToObj[i]-1]*lambda_low )
+		else if( isIntegerOnly ? isBelowRatio(lgcArea[i], objArea[lgcToObj[i]-1], fixedLambda) :
+				lgcArea[i] < objArea[lgcToObj[i]-1]*lambda_low )
 		{
 			// cerr << "lgc " << i << " is shadow = false: " << 3 << " objArea = " << objArea[lgcToObj[i]-1] << endl;
 			lgcIsShadow[i] = false;
@@ -932,43 +2072,650 @@ void MCSS::operator()(Mat current, Mat background, Mat mask, OutputArray output)
 
 
 	/* 
-	 * check each pixel if it belongs to shadow
+	 * check each pixel if it belongs to shadow, object by object
 	 * (Part III. MOVING SHADOW DETECTION, E. Classification Process)
+	 * the objects that kept their lgcs have the frame's numbers already
 	 * */
-	for( i = 0 ; i < post_mask.rows ; ++i )
+	for( k = 0 ; k < objNum && reusedNum > 0 ; ++k )
 	{
-		for( j = 0 ; j < post_mask.cols ; ++j )
+		if( scratch.reuse[k] >= 0 )
+			scratch.lgcOffset[k] = 0;
+	}
+	parallel_for_(Range(0, scratch.pieces.size()), ObjectClassifier(objLabel, lgcLabel, dst, lgcIsShadow,
+				objBox, scratch));
+
+	/* the labels of the node components are done with, the distance codes go there */
+	if( hasFringe )
+		parallel_for_(Range(0, regions.size()), FringeCorrector(dst, scratch.fringe, scratch.labels, regions));
+	result = dst;
+	resultInRegions = true;
+	if( reuseInterval > 0 )
+		saveHistory();
+	STATS(stats.stageTime[STAGE_CLASSIFY] = lap(tick));
+	STATS(stats.frameTime = lap(frameTick));
+	if( diag != NULL )
+		publishDiagnostics();
+}
+
+/**
+ * @brief publishDiagnostics: copy the intermediate results of this frame
+ *							  into a free slot of the diagnostics ring
+ *
+ * Drops the frame if the reader is behind, the model never waits for it.
+ */
+void MCSS::publishDiagnostics()
+{
+	MCSS_DiagFrame *frame = diag->beginWrite();
+	int i;
+
+	if( frame == NULL )
+		return;
+	frame->frame = nframes;
+	lumRatio.copyTo(frame->lumRatio);
+	lgcLabel.copyTo(frame->lgcLabel);
+	/* the slot vectors keep their capacity, so this doesn't allocate once warmed up */
+	frame->mgThr.assign(mgThr.begin(), mgThr.end());
+	frame->lgcs.resize(tpw.size());
+	for( i = 0 ; i < (int)tpw.size() ; ++i )
+	{
+		MCSS_LGCInfo &lgc = frame->lgcs[i];
+		lgc.area = lgcArea[i];
+		lgc.object = lgcToObj[i];
+		lgc.mean = meanLGC[i];
+		lgc.tpw = tpw[i];
+		lgc.external = scratch.external[i];
+		lgc.all = scratch.all[i];
+		lgc.isShadow = lgcIsShadow[i];
+	}
+	frame->stats = stats;
+	diag->endWrite();
+}
+
+/**
+ * @brief findReusable: find the objects that can keep the LGCs of the last frame
+ *
+ * Each object is matched to the object of the last frame its box overlaps
+ * the most, if no other object took it yet. It keeps that object's LGCs if
+ * less than reuseMaxChange of its area changed (see countChanged) and they
+ * haven't been kept for reuseInterval-1 frames already.
+ *
+ * @return: number of objects that keep their LGCs, scratch.reuse gets the
+ *			object of the last frame each one keeps them from (-1 for none)
+ */
+int MCSS::findReusable()
+{
+	vector<int> &reuse = scratch.reuse, &owner = scratch.reuseOwner, &objAge = scratch.objAge;
+	int o, p, best, bestArea, area, limit, changed, num = 0;
+
+	reuse.assign(objBox.size(), -1);
+	objAge.assign(objBox.size(), 0);
+	owner.assign(history.objBox.size(), -1);
+	/* nothing to compare with, or the luminance ratio changed its type */
+	if( history.objBox.empty() || history.lumRatio.type() != lumRatio.type() )
+		return 0;
+	for( o = 0 ; o < (int)objBox.size() ; ++o )
+	{
+		best = -1;
+		bestArea = 0;
+		for( p = 0 ; p < (int)history.objBox.size() ; ++p )
 		{
-			if( lgcLabel.at<ushort>(i, j) == SMALL_LGC_LABEL )
-				dst.at<uchar>(i, j) = 255;
-			if( lgcLabel.at<ushort>(i, j) == 0 || dst.at<uchar>(i, j) == 255 || dst.at<uchar>(i, j) == 0 )
-				continue;
-			if( !lgcIsShadow[lgcLabel.at<ushort>(i, j)-1] ) 
+			area = (objBox[o] & history.objBox[p]).area();
+			if( area > bestArea )
 			{
-				dst.at<uchar>(i, j) = 255; 
+				best = p;
+				bestArea = area;
 			}
 		}
+		if( best < 0 || owner[best] >= 0 || history.objAge[best]+1 >= reuseInterval )
+			continue;
+		Rect box = objBox[o] | history.objBox[best];
+		limit = cvFloor(reuseMaxChange*objArea[o]);
+		if( isFixedPoint )
+			changed = countChanged<Vec3w, int>(objLabel, history.objLabel, lumRatio, history.lumRatio,
+					box, o+1, best+1, scratch.fixedMGThr[o], limit);
+		else
+			changed = countChanged<Vec3f, float>(objLabel, history.objLabel, lumRatio, history.lumRatio,
+					box, o+1, best+1, mgThr[o], limit);
+		if( changed > limit )
+			continue;
+		reuse[o] = best;
+		owner[best] = o;
+		objAge[o] = history.objAge[best]+1;
+		++num;
 	}
+	return num;
+}
 
-#if 0
-	if( hasFringe )
+/**
+ * @brief reuseLGC: give the objects found by findReusable the LGCs of the last frame
+ *
+ * @param lgcNum: number of lgcs searched in this frame, the reused ones are numbered after them
+ *
+ * @return: number of lgcs reused
+ */
+int MCSS::reuseLGC(int lgcNum)
+{
+	const vector<int> &reuse = scratch.reuse, &owner = scratch.reuseOwner;
+	vector<int> &remap = scratch.remap, &reuseFrom = scratch.reuseFrom;
+	int i, j, k, l, o, num = 0;
+
+	/* number the lgcs of the matched objects after the new ones, in their old order */
+	remap.assign(history.lgcArea.size()+1, 0);
+	reuseFrom.clear();
+	for( l = 0 ; l < (int)history.lgcArea.size() ; ++l )
 	{
-		tmp = Mat::zeros(dst.size(), CV_8UC1);
-		for( i = 0 ; i < post_mask.rows ; ++i )
+		o = owner[history.lgcToObj[l]-1];
+		if( o < 0 )
+			continue;
+		remap[l+1] = lgcNum+(++num);
+		reuseFrom.push_back(l);
+		lgcArea.push_back(history.lgcArea[l]);
+		lgcToObj.push_back(o+1);
+		meanLGC.push_back(history.meanLGC[l]);
+		scratch.external.push_back(history.external[l]);
+		scratch.all.push_back(history.all[l]);
+	}
+
+	/*
+	 * copy their labels. A shadow like pixel with no lgc to take, new to
+	 * the object or in no lgc of it last frame, is taken as foreground.
+	 * */
+	for( k = 0 ; k < (int)reuse.size() ; ++k )
+	{
+		if( reuse[k] < 0 )
+			continue;
+		const Rect &r = objBox[k];
+		for( i = r.y ; i < r.y+r.height ; ++i )
 		{
-			for( j = 0 ; j < post_mask.cols ; ++j )
+			const int *obj = objLabel.ptr<int>(i), *prevObj = history.objLabel.ptr<int>(i);
+			const uchar *d = dst.ptr<uchar>(i);
+			const int *prevLgc = history.lgcLabel.ptr<int>(i);
+			int *lgc = lgcLabel.ptr<int>(i);
+			for( j = r.x ; j < r.x+r.width ; ++j )
 			{
-				if( mask.at<uchar>(i, j) && !post_mask.at<uchar>(i, j) )
+				if( obj[j] != k+1 )
+					continue;
+				if( prevObj[j] != reuse[k]+1 )
 				{
-					int val = getNearestVal(Point(i, j));
-					tmp.at<uchar>(i, j) = val;
+					if( d[j] == 127 )
+						lgc[j] = SMALL_LGC_LABEL;
 					continue;
 				}
+				l = prevLgc[j];
+				if( l == SMALL_LGC_LABEL )
+					lgc[j] = SMALL_LGC_LABEL;
+				else if( l != 0 )
+					lgc[j] = remap[l];
+				else if( d[j] == 127 )
+					lgc[j] = SMALL_LGC_LABEL;
 			}
 		}
-		dst += tmp;
 	}
-#endif
-	dst.copyTo(output);
-	// imshow("tmp", tmp);
+	return num;
+}
+
+/**
+ * @brief saveHistory: keep what the temporal reuse needs of this frame
+ */
+void MCSS::saveHistory()
+{
+	int k, n = lgcArea.size();
+
+	/* the buffers are zero outside the regions of the frame they hold */
+	if( history.lumRatio.type() != lumRatio.type() )
+	{
+		history.objLabel = Mat::zeros(frameSize, CV_32SC1);
+		history.lgcLabel = Mat::zeros(frameSize, CV_32SC1);
+		history.lumRatio = Mat::zeros(frameSize, lumRatio.type());
+	}
+	else
+	{
+		clearRegions(history.objLabel, history.regions);
+		clearRegions(history.lgcLabel, history.regions);
+		clearRegions(history.lumRatio, history.regions);
+	}
+	for( k = 0 ; k < (int)scratch.regions.size() ; ++k )
+	{
+		const Rect &r = scratch.regions[k];
+		objLabel(r).copyTo(history.objLabel(r));
+		lgcLabel(r).copyTo(history.lgcLabel(r));
+		lumRatio(r).copyTo(history.lumRatio(r));
+	}
+	history.regions = scratch.regions;
+	history.objBox = objBox;
+	history.objAge.assign(scratch.objAge.begin(), scratch.objAge.begin()+objBox.size());
+	history.lgcArea = lgcArea;
+	history.lgcToObj = lgcToObj;
+	history.meanLGC = meanLGC;
+	history.isShadow = lgcIsShadow;
+	history.external.assign(scratch.external.begin(), scratch.external.begin()+n);
+	history.all.assign(scratch.all.begin(), scratch.all.begin()+n);
+}
+
+/**
+ * @brief markBoundaries: find the boundaries of the coarse result
+ *
+ * @param src: the coarse result, background(0), foreground(255) and shadow(127)
+ * @param edge: for each pixel, 0 if its 3x3 neighbourhood is all the same,
+ *			else PYR_BOUNDARY, plus PYR_NEAR_SHADOW if it holds shadow
+ */
+static void markBoundaries(const Mat &src, Mat &edge)
+{
+	int i, j, di, dj;
+
+	edge.create(src.size(), CV_8UC1);
+	for( i = 0 ; i < src.rows ; ++i )
+	{
+		const uchar *rows[3] = {src.ptr<uchar>(max(i-1, 0)), src.ptr<uchar>(i),
+			src.ptr<uchar>(min(i+1, src.rows-1))};
+		uchar *e = edge.ptr<uchar>(i);
+		for( j = 0 ; j < src.cols ; ++j )
+		{
+			uchar c = rows[1][j], mark = 0;
+			bool mixed = false;
+			for( di = 0 ; di < 3 ; ++di )
+			{
+				for( dj = max(j-1, 0) ; dj <= min(j+1, src.cols-1) ; ++dj )
+				{
+					uchar val = rows[di][dj];
+					mixed = mixed || val != c;
+					if( val == 127 )
+						mark = PYR_NEAR_SHADOW;
+				}
+			}
+			e[j] = mixed ? PYR_BOUNDARY | mark : 0;
+		}
+	}
+}
+
+/**
+ * @brief downsample: shrink an 8-bit image by 2^levels, averaging blocks
+ *
+ * A box filter over the blocks of 2^levels x 2^levels pixels, cut at the
+ * right and bottom borders. Unlike resize it allocates nothing once dst
+ * and the row sums have their sizes.
+ *
+ * @param src: the full resolution image, any number of channels
+ * @param levels: times the image is halved
+ * @param size: size of dst, at least 1x1
+ * @param binary: src is a mask, a pixel of dst is 255 if more than half
+ *				  of its block is, else 0
+ * @param sum: sums of the channels of the blocks of a row of dst
+ * @param dst: the shrunk image
+ */
+static void downsample(const Mat &src, int levels, Size size, bool binary, vector<int> &sum, Mat &dst)
+{
+	int i, j, k, x, c, n = src.channels(), step = 1 << levels;
+
+	dst.create(size, src.type());
+	sum.resize(size.width*n);
+	for( i = 0 ; i < size.height ; ++i )
+	{
+		int top = i << levels, bottom = min(top+step, src.rows);
+		uchar *d = dst.ptr<uchar>(i);
+		fill(sum.begin(), sum.end(), 0);
+		for( k = top ; k < bottom ; ++k )
+		{
+			const uchar *s = src.ptr<uchar>(k);
+			for( j = 0 ; j < size.width ; ++j )
+			{
+				int *t = &sum[j*n];
+				for( x = (j << levels)*n ; x < min((j << levels)+step, src.cols)*n ; x += n )
+					for( c = 0 ; c < n ; ++c )
+						t[c] += s[x+c];
+			}
+		}
+		for( j = 0 ; j < size.width ; ++j )
+		{
+			int area = (bottom-top)*(min((j << levels)+step, src.cols)-(j << levels));
+			for( c = 0 ; c < n ; ++c )
+			{
+				int t = sum[j*n+c];
+				d[j*n+c] = binary ? (t > 127*area ? 255 : 0) : (uchar)((t+area/2)/area);
+			}
+		}
+	}
+}
+
+/* the shadow lgcs of the coarse model, what the boundaries of pyramid mode are refined against */
+template<typename P, typename T>
+struct CoarseLGCs
+{
+	const Mat &label, &result;
+	const vector<bool> &isShadow;
+	/* mean luminance ratio of each lgc, in the type of the ratio */
+	const vector<P> &mean;
+	const vector<int> &lgcToObj;
+	const vector< Vec<T, 3> > &mgThr;
+	T threshold1, threshold2;
+};
+
+/* the luminance ratio of one shadow like pixel, as lumRatioRow computes it */
+static inline void pixelRatio(const uchar *cur, const uchar *bg, float v, const ushort *, Vec3f &r)
+{
+	r[0] = (bg[0]+v)/(cur[0]+v);
+	r[1] = (bg[1]+v)/(cur[1]+v);
+	r[2] = (bg[2]+v)/(cur[2]+v);
+}
+
+/* the same as lumRatioRowLUT */
+static inline void pixelRatio(const uchar *cur, const uchar *bg, float, const ushort *table, Vec3w &r)
+{
+	r[0] = table[bg[0]*256+cur[0]];
+	r[1] = table[bg[1]*256+cur[1]];
+	r[2] = table[bg[2]*256+cur[2]];
+}
+
+/**
+ * @brief joinsCoarseLGC: check if a full resolution pixel would join a
+ *						  shadow lgc of the coarse pixels around its own
+ *
+ * @param r: luminance ratio of the pixel
+ * @param lgcs: the coarse lgcs
+ * @param ci: coarse row of the pixel
+ * @param cj: coarse column of the pixel
+ *
+ * @return: true if the ratio lies within the thresholds, and within the
+ *			mgThr of its object from the mean of one of the coarse shadow
+ *			lgcs in the 3x3 neighbourhood
+ */
+template<typename P, typename T>
+static bool joinsCoarseLGC(const P &r, const CoarseLGCs<P, T> &lgcs, int ci, int cj)
+{
+	const Mat &labels = lgcs.label, &result = lgcs.result;
+	int i, j, l;
+
+	if( !isLGCNode(r, lgcs.threshold1, lgcs.threshold2) )
+		return false;
+	for( i = max(ci-1, 0) ; i <= min(ci+1, labels.rows-1) ; ++i )
+	{
+		const int *label = labels.ptr<int>(i);
+		const uchar *c = result.ptr<uchar>(i);
+		for( j = max(cj-1, 0) ; j <= min(cj+1, labels.cols-1) ; ++j )
+		{
+			l = label[j];
+			/* a shadow pixel of a reused object may have no lgc */
+			if( c[j] != 127 || l <= 0 || l == SMALL_LGC_LABEL || !lgcs.isShadow[l-1] )
+				continue;
+			if( isLGCEdge(r, lgcs.mean[l-1], lgcs.mgThr[lgcs.lgcToObj[l-1]-1]) )
+				return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * @brief refinePyramid: the full resolution result of pyramid mode
+ *
+ * @param current: the current frame
+ * @param background: the background image
+ * @param mask: mask image from any BS model
+ * @param edge: boundaries of the coarse result, see markBoundaries
+ * @param pyrRow: coarse row of each row
+ * @param pyrCol: coarse column of each column
+ * @param hasFringe: the coarse model removed the fringe
+ * @param v: offset of the luminance ratio
+ * @param table: the fixed point luminance ratio table, NULL in float
+ * @param lgcs: the coarse lgcs
+ * @param dst: the result
+ */
+template<typename P, typename T>
+static void refinePyramid(const Mat &current, const Mat &background, const Mat &mask, const Mat &edge,
+		const vector<int> &pyrRow, const vector<int> &pyrCol, bool hasFringe, float v,
+		const ushort *table, const CoarseLGCs<P, T> &lgcs, Mat &dst)
+{
+	const Mat &coarseDst = lgcs.result;
+	int i, j, k;
+	P r;
+
+	for( i = 0 ; i < mask.rows ; ++i )
+	{
+		const uchar *c = coarseDst.ptr<uchar>(pyrRow[i]), *e = edge.ptr<uchar>(pyrRow[i]);
+		const uchar *m = mask.ptr<uchar>(i), *cur = current.ptr<uchar>(i), *bg = background.ptr<uchar>(i);
+		uchar *d = dst.ptr<uchar>(i);
+		for( j = 0 ; j < mask.cols ; ++j, cur += 3, bg += 3 )
+		{
+			k = pyrCol[j];
+			if( m[j] == 0 )
+				d[j] = 0;
+			else if( e[k] == 0 || (c[k] == 0 && hasFringe) )
+				d[j] = c[k];
+			else if( !(e[k] & PYR_NEAR_SHADOW) || bg[0] < cur[0] || bg[1] < cur[1] || bg[2] < cur[2] )
+				d[j] = 255;
+			else
+			{
+				pixelRatio(cur, bg, v, table, r);
+				d[j] = joinsCoarseLGC(r, lgcs, pyrRow[i], k) ? 127 : 255;
+			}
+		}
+	}
+}
+
+/**
+ * @brief runPyramid: update the model in pyramid mode
+ *
+ * The model of the coarse level finds the objects and classifies the
+ * LGCs on the halved frames. A full resolution pixel in the mask takes the
+ * result of its coarse pixel, unless that one lies on a boundary of the
+ * coarse result. There the pixel is shadow if it is shadow like (darker
+ * than the background in each channel, the test of lumRatioRow) and its
+ * luminance ratio passes the lgc tests against a coarse shadow lgc next
+ * to it (joinsCoarseLGC), else foreground. With the fringe removal a
+ * coarse background pixel stays background, the erosion has removed it.
+ * Away from the boundaries this is a lookup, so the full resolution
+ * result costs little more than the coarse level. The diagnostics are
+ * those of the coarse level.
+ *
+ * @param current: the current frame
+ * @param background: the background image
+ * @param mask: mask image from any BS model
+ */
+void MCSS::runPyramid(Mat current, Mat background, Mat mask)
+{
+	Size size = mask.size();
+	Size coarseSize(max(size.width >> pyramidLevels, 1), max(size.height >> pyramidLevels, 1));
+	vector<int> &pyrRow = scratch.pyrRow, &pyrCol = scratch.pyrCol;
+	int i, j;
+
+	MCSS &coarseModel = *coarse.model;
+
+	STATS(int64 frameTick = getTickCount(), tick = frameTick);
+	/* our buffers are not kept up, the full resolution model starts over if the pyramid is turned off */
+	nframes = 0;
+	dst.create(size, CV_8UC1);
+
+	downsample(current, pyramidLevels, coarseSize, false, scratch.pyrSum, scratch.pyrCurrent);
+	downsample(background, pyramidLevels, coarseSize, false, scratch.pyrSum, scratch.pyrBackground);
+	/* a coarse pixel is in the mask if most of its pixels are */
+	downsample(mask, pyramidLevels, coarseSize, true, scratch.pyrSum, scratch.pyrMask);
+	STATS(double pyramidTime = lap(tick));
+	coarseModel(scratch.pyrCurrent, scratch.pyrBackground, scratch.pyrMask);
+	STATS(tick = getTickCount());
+
+	/* no object, the mask is the result like at full resolution */
+	resultInRegions = false;
+	if( coarseModel.objBox.empty() )
+	{
+		result = mask;
+		STATS(stats = coarseModel.stats);
+		STATS(stats.stageTime[STAGE_PYRAMID] = pyramidTime+lap(tick));
+		STATS(stats.frameTime = lap(frameTick));
+		return;
+	}
+	const Mat &coarseDst = coarseModel.result;
+	markBoundaries(coarseDst, scratch.pyrEdge);
+	pyrRow.resize(size.height);
+	pyrCol.resize(size.width);
+	for( i = 0 ; i < size.height ; ++i )
+		pyrRow[i] = i*coarseSize.height/size.height;
+	for( j = 0 ; j < size.width ; ++j )
+		pyrCol[j] = j*coarseSize.width/size.width;
+	if( isFixedPoint )
+	{
+		/* the means in the fixed point of the ratio, once per lgc */
+		const float scale = 1 << LUMRATIO_FIXED_SHIFT;
+		vector<Vec3w> &mean = scratch.pyrMean;
+		mean.resize(coarseModel.meanLGC.size());
+		for( i = 0 ; i < (int)mean.size() ; ++i )
+			for( j = 0 ; j < 3 ; ++j )
+				mean[i][j] = saturate_cast<ushort>(coarseModel.meanLGC[i][j]*scale);
+		CoarseLGCs<Vec3w, int> lgcs = {coarseModel.lgcLabel, coarseDst, coarseModel.lgcIsShadow, mean,
+			coarseModel.lgcToObj, coarseModel.scratch.fixedMGThr, cvRound(threshold1*scale), cvRound(threshold2*scale)};
+		refinePyramid(current, background, mask, scratch.pyrEdge, pyrRow, pyrCol, hasFringe, v,
+				coarseModel.scratch.ratioTable, lgcs, dst);
+	}
+	else
+	{
+		CoarseLGCs<Vec3f, float> lgcs = {coarseModel.lgcLabel, coarseDst, coarseModel.lgcIsShadow, coarseModel.meanLGC,
+			coarseModel.lgcToObj, coarseModel.mgThr, threshold1, threshold2};
+		refinePyramid(current, background, mask, scratch.pyrEdge, pyrRow, pyrCol, hasFringe, v,
+				(const ushort *)NULL, lgcs, dst);
+	}
+	result = dst;
+	STATS(stats = coarseModel.stats);
+	STATS(stats.stageTime[STAGE_PYRAMID] = pyramidTime+lap(tick));
+	STATS(stats.frameTime = lap(frameTick));
+}
+
+/**
+ * @brief writeResult: copy the result of the last frame to an output array
+ */
+void MCSS::writeResult(OutputArray output) const
+{
+	output.create(result.size(), CV_8UC1);
+	Mat out = output.getMat();
+	getResult(out.data, out.step);
+}
+
+/**
+ * @brief getResult: write the result mask of the last frame
+ *
+ * Only the regions are read when the result is dst, the rest of the
+ * caller's rows is zeroed.
+ *
+ * @param data: the caller's buffer, a CV_8UC1 plane of the frame size
+ * @param step: bytes from a row to the next one
+ */
+void MCSS::getResult(uchar *data, size_t step) const
+{
+	const vector<Rect> &regions = scratch.regions;
+	const vector<int> &rowStart = scratch.rowStart, &rowRegions = scratch.rowRegions;
+	int i, k, x;
+
+	for( i = 0 ; i < result.rows ; ++i )
+	{
+		const uchar *src = result.ptr<uchar>(i);
+		uchar *out = data+i*step;
+		if( !resultInRegions )
+		{
+			if( out != src )
+				memcpy(out, src, result.cols);
+			continue;
+		}
+		for( x = 0, k = rowStart[i] ; k < rowStart[i+1] ; ++k )
+		{
+			const Rect &r = regions[rowRegions[k]];
+			memset(out+x, 0, r.x-x);
+			memcpy(out+r.x, src+r.x, r.width);
+			x = r.x+r.width;
+		}
+		memset(out+x, 0, result.cols-x);
+	}
+}
+
+/**
+ * @brief packRow: or the 2-bit codes of the pixels [x0, x1) of a row into the packed row
+ */
+static inline void packRow(const uchar *src, uchar *out, int x0, int x1)
+{
+	for( int j = x0 ; j < x1 ; ++j )
+	{
+		if( src[j] != 0 )
+			out[j >> 2] |= (src[j] == 127 ? 1 : 2) << 2*(j & 3);
+	}
+}
+
+/**
+ * @brief getPackedResult: write the result of the last frame as 2-bit codes
+ *
+ * @param data: the caller's buffer, (width+3)/4 bytes a row
+ * @param step: bytes from a row to the next one
+ */
+void MCSS::getPackedResult(uchar *data, size_t step) const
+{
+	const vector<Rect> &regions = scratch.regions;
+	const vector<int> &rowStart = scratch.rowStart, &rowRegions = scratch.rowRegions;
+	int i, k;
+
+	for( i = 0 ; i < result.rows ; ++i )
+	{
+		const uchar *src = result.ptr<uchar>(i);
+		uchar *out = data+i*step;
+		memset(out, 0, (result.cols+3)/4);
+		if( !resultInRegions )
+		{
+			packRow(src, out, 0, result.cols);
+			continue;
+		}
+		for( k = rowStart[i] ; k < rowStart[i+1] ; ++k )
+		{
+			const Rect &r = regions[rowRegions[k]];
+			packRow(src, out, r.x, r.x+r.width);
+		}
+	}
+}
+
+/**
+ * @brief addRuns: add the runs of the pixels [x0, x1) of a row, joining the last run if it goes on
+ */
+static void addRuns(const uchar *src, int x0, int x1, int rowStart, vector<MCSS_Run> &runs)
+{
+	for( int j = x0 ; j < x1 ; ++j )
+	{
+		if( src[j] == 0 )
+			continue;
+		if( (int)runs.size() > rowStart && runs.back().x+runs.back().length == j && runs.back().value == src[j] )
+		{
+			++runs.back().length;
+			continue;
+		}
+		MCSS_Run run;
+		run.x = j;
+		run.length = 1;
+		run.value = src[j];
+		runs.push_back(run);
+	}
+}
+
+/**
+ * @brief getResultRuns: encode the result of the last frame as runs of each row
+ *
+ * @param runs: the runs of non zero values, of the rows one after the other
+ * @param rowStart: the runs of row i are runs[rowStart[i] .. rowStart[i+1])
+ */
+void MCSS::getResultRuns(vector<MCSS_Run> &runs, vector<int> &rowStart) const
+{
+	const vector<Rect> &regions = scratch.regions;
+	const vector<int> &regionStart = scratch.rowStart, &rowRegions = scratch.rowRegions;
+	int i, k;
+
+	runs.clear();
+	rowStart.resize(result.rows+1);
+	for( i = 0 ; i < result.rows ; ++i )
+	{
+		const uchar *src = result.ptr<uchar>(i);
+		rowStart[i] = runs.size();
+		if( !resultInRegions )
+		{
+			addRuns(src, 0, result.cols, rowStart[i], runs);
+			continue;
+		}
+		/* the regions of a row are sorted by x, so the runs are too */
+		for( k = regionStart[i] ; k < regionStart[i+1] ; ++k )
+		{
+			const Rect &r = regions[rowRegions[k]];
+			addRuns(src, r.x, r.x+r.width, rowStart[i], runs);
+		}
+	}
+	rowStart[result.rows] = runs.size();
 }
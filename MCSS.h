@@ -3,6 +3,7 @@
 
 #include  <iostream>
 #include  <string>
+#include  <climits>
 #include  <opencv2/opencv.hpp>
 
 using namespace cv;
@@ -10,12 +11,10 @@ using namespace std;
 
 
 /* some default parameters */
-#define  MAX_OBJ_NUM		100
 #define  MIN_OBJ_AREA		200
-#define  STACK_SIZE			200000
-#define  MAX_LGC_NUM		900
 #define  MIN_LGC_AREA		5
-#define  SMALL_LGC_LABEL	65535
+/* the labels are 32-bit, no lgc count reaches this one */
+#define  SMALL_LGC_LABEL	INT_MAX
 
 #define  LOW_LUMINANCE_RATIO_THRESHOLD	1
 #define  HIGH_LUMINANCE_RATIO_THRESHOLD	6
@@ -26,6 +25,15 @@ using namespace std;
 #define  FRAME_WINDOW 60
 #define  HISTORY	30
 #define  DEFAULT_MGTHR_FIXED	(Vec3f(0.22, 0.22, 0.22))
+/* foreground test of the built-in background model */
+#define  DEFAULT_FG_DEVIATION	4
+#define  DEFAULT_FG_MIN_DIFF	15
+/* part of an object's pixels that may change while it keeps its LGCs */
+#define  DEFAULT_REUSE_MAX_CHANGE	0.02
+/* fractional bits of the fixed point luminance ratio */
+#define  LUMRATIO_FIXED_SHIFT	10
+/* fractional bits of the background statistics in the integer only mode, at most 7 */
+#define  BG_FIXED_SHIFT	7
 
 /* some parameters of the model */
 struct MCSS_Param
@@ -37,6 +45,243 @@ struct MCSS_Param
 	Vec3f mgThrFixed;
 	bool isMGThrFixed;
 	bool hasFringe;
+	/* 
+	 * keep the luminance ratio in 16-bit fixed point (LUMRATIO_FIXED_SHIFT
+	 * fractional bits) looked up from a 256x256 table instead of dividing.
+	 * Each stored ratio is within 2^-11 of the float one and saturates at
+	 * 64, the thresholds are rounded the same way, so a pixel or a pair of
+	 * pixels can only be judged differently from the float path when its
+	 * ratio (or their ratio difference) lies within 2^-9 of threshold1,
+	 * threshold2 or mgThr, and meanLGC is within 2^-11 of the float mean of
+	 * the same region. With threshold2 + mgThr < 64 nothing else changes.
+	 * */
+	bool isFixedPoint;
+	/* 
+	 * integer only, turns isFixedPoint on too: the background statistics
+	 * are 16-bit with BG_FIXED_SHIFT fractional bits, each update rounded
+	 * (see backgroundRowFixed), which keeps them within about 0.05 of the
+	 * float ones, and mgThr is computed from their object
+	 * means straight into the fixed point of the luminance ratio, rounded
+	 * up, with alpha kept to 2^-32. The terminal point weight and the
+	 * relative size tests compare integer products, tao and lambda_low
+	 * kept to 2^-16. No float operation is left on the pixels, the float
+	 * mgThr, tpw and meanLGC are only filled in for the diagnostics.
+	 * bench --integer counts the pixels it classifies unlike the float model.
+	 * */
+	bool isIntegerOnly;
+	/* 
+	 * temporal reuse: an object that overlaps one of the last frame the
+	 * most and changed on less than reuseMaxChange of its area (pixels
+	 * that joined or left it, or whose luminance ratio moved by mgThr or
+	 * more) keeps that object's LGC labels and shadow decisions instead of
+	 * searching them again. An object is recomputed after keeping them for
+	 * reuseInterval-1 frames. 0 (the default) turns reuse off.
+	 * */
+	int reuseInterval;
+	float reuseMaxChange;
+	/* 
+	 * coarse to fine: run the model on the frames halved pyramidLevels
+	 * times, then take its result for each full resolution pixel, except
+	 * around the boundaries of the coarse result, where a pixel of the
+	 * mask is shadow only if its own luminance ratio would join one of the
+	 * coarse shadow LGCs next to it. 0 (the default) runs at full resolution.
+	 * */
+	int pyramidLevels;
+	/* 
+	 * built-in background model, used when the model is given the frame
+	 * alone: a pixel is foreground if one of its channels is further than
+	 * fgDeviation mean absolute deviations, and than fgMinDiff, from the
+	 * running mean of the background statistics
+	 * */
+	float fgDeviation, fgMinDiff;
+};
+
+/* stages of a frame, timed by MCSS_Stats */
+enum MCSS_Stage
+{
+	/* clearing the last frame, object labeling, the regions and the fringe removal */
+	STAGE_OBJECTS,
+	/* background statistics (with the built-in background model) and the minimum gradient threshold */
+	STAGE_BACKGROUND,
+	/* luminance ratio and its closing */
+	STAGE_LUMRATIO,
+	/* LGC search: node labeling of the pieces of the objects and the temporal reuse */
+	STAGE_LGC,
+	/* per object seam merge, seed replay and LGC labels, with the meanLGC sum and the terminal pixel count */
+	STAGE_LGC_STATS,
+	/* terminal point weight, the classification of the pixels and the edge noise correction */
+	STAGE_CLASSIFY,
+	/* pyramid mode: halving the frames and refining the coarse result */
+	STAGE_PYRAMID,
+	STAGE_NUM
+};
+
+/* 
+ * timings and work counters of the last frame. Build with -DMCSS_NO_STATS
+ * to compile them out of the hot path, then they stay zero.
+ * */
+struct MCSS_Stats
+{
+	/* wall time (ms) of each stage and of the whole frame */
+	double stageTime[STAGE_NUM];
+	double frameTime;
+	/* connected regions of the mask accepted as objects, and rejected (too small) */
+	int objects, rejectedObjects;
+	/* LGC regions found (reused ones included), and LGC seeds rejected as SMALL_LGC_LABEL */
+	int lgcs, rejectedLGCs;
+	/* objects that kept the LGCs of the last frame */
+	int reusedObjects;
+	/* pixels scanned by the object labeler plus those scanned by the LGC labeler */
+	long long visitedPixels;
+	/* 
+	 * the labelers use union-find instead of a flood fill, so there is no
+	 * stack, their working set is the equivalence table. This is its peak
+	 * number of provisional labels (objects) or node components (LGC).
+	 * */
+	int peakLabels;
+};
+
+/* 
+ * a task of the per object passes: the objects [first, last), and only
+ * their rows [rowBegin, rowEnd) when a large object is split
+ * */
+struct MCSS_Task
+{
+	MCSS_Task(int _first, int _last, int _rowBegin, int _rowEnd)
+		: first(_first), last(_last), rowBegin(_rowBegin), rowEnd(_rowEnd)
+	{
+	}
+
+	int first, last, rowBegin, rowEnd;
+};
+
+/* the lgcs a batch of objects found, numbered from 1 in the batch */
+struct MCSS_LGCTable
+{
+	/* area and lgc of each node component of the batch */
+	vector<int> compArea, compLGC;
+	/* area, object, terminal pixels, mean and fixed point sum (3 each) of each lgc */
+	vector<int> area, object, external, all;
+	vector<Vec3f> mean;
+	vector<long long> sum;
+	/* LGC seeds rejected as SMALL_LGC_LABEL */
+	int rejected;
+};
+
+/* 
+ * scratch memory of a model, sized on the first frame and reused
+ * by the later ones, so that two models never share any buffer
+ * */
+struct MCSS_Scratch
+{
+	MCSS_Scratch() : ratioTable(NULL)
+	{
+	}
+
+	/* provisional object labels, later the LGC node components and the edge noise correction's distances */
+	Mat labels;
+	/* equivalence table, area and final index of the provisional labels */
+	vector<int> parent, area, remap;
+	/* bounding box (x0, y0, x1, y1) of the provisional labels */
+	vector<Vec4i> box;
+	/* bounding box of every connected region of the mask */
+	vector<Rect> blobBox;
+	/* 
+	 * the disjoint regions the passes run on, and the regions crossing
+	 * row i in rowRegions[rowStart[i] .. rowStart[i+1]). Outside the
+	 * regions of the last frame all the per frame buffers are zero.
+	 * */
+	vector<Rect> regions;
+	vector<int> rowStart, rowRegions;
+	/* 
+	 * tasks of the per object passes: the pieces the nodes are labeled and
+	 * the pixels classified in, and the batches the lgcs are searched in,
+	 * each with its table. Object o is split every splitRows[o] rows (0 if
+	 * not) and lgcOffset[o] moves the labels of its batch to the frame's.
+	 * */
+	vector<MCSS_Task> pieces, batches;
+	vector<MCSS_LGCTable> lgcTables;
+	vector<int> splitRows, lgcOffset;
+	/* 
+	 * sums of the background mean and STD of each object, 6 for each band
+	 * its box crosses, those of object o start at bgSumStart[o]
+	 * */
+	vector<double> bgSum;
+	vector<int> bgSumStart;
+	/* the same sums in the integer only mode */
+	vector<long long> bgSumFixed;
+	/* number of external terminal pixels and all terminal pixels of each lgc */
+	vector<int> external, all;
+	/* 
+	 * mask of the objects (the 8-bit objLabel != 0 the background update
+	 * reads) and the eroded one of the fringe removal
+	 * */
+	Mat objMask, post_mask;
+	/* the object pixels the erosion took, which the edge noise correction sets */
+	Mat fringe;
+	/* rows of the separable erosion of the fringe removal and closing of the luminance ratio */
+	Mat morphMask, morphRatio;
+	/* fixed point luminance ratio of each (background, current) pair, shared by the models */
+	const ushort *ratioTable;
+	/* fixed point minimum gradient threshold of each object */
+	vector<Vec3i> fixedMGThr;
+	/* fixed point sum of the luminance ratio of each lgc, 3 channels each */
+	vector<long long> lgcSum;
+	/* objLabel without the objects that keep their LGCs */
+	Mat lgcObj;
+	/* 
+	 * object of the last frame each object keeps the LGCs of (-1 if none),
+	 * the other way round, and the frames each object has kept them
+	 * */
+	vector<int> reuse, reuseOwner, objAge;
+	/* lgc of the last frame each reused lgc comes from */
+	vector<int> reuseFrom;
+	/* pyramid mode: the halved frames, the coarse result and its boundaries */
+	Mat pyrCurrent, pyrBackground, pyrMask, pyrEdge;
+	/* coarse row and column of each full resolution row and column */
+	vector<int> pyrRow, pyrCol;
+	/* mean luminance ratio of each coarse lgc in fixed point */
+	vector<Vec3w> pyrMean;
+	/* sums of the blocks of a coarse row while halving the frames */
+	vector<int> pyrSum;
+};
+
+/* what the temporal reuse keeps of the last frame */
+struct MCSS_History
+{
+	/* objects, lgc labels and luminance ratio, zero outside the regions */
+	Mat objLabel, lgcLabel, lumRatio;
+	vector<Rect> regions;
+	/* box of each object and the frames it had kept its LGCs */
+	vector<Rect> objBox;
+	vector<int> objAge;
+	/* the lgc table */
+	vector<int> lgcArea, lgcToObj, external, all;
+	vector<Vec3f> meanLGC;
+	vector<bool> isShadow;
+};
+
+class MCSSDiagnostics;
+class MCSS;
+
+/* 
+ * the model of the coarse level in pyramid mode. A copy of the model gets
+ * a copy of it, so the two don't write into one coarse state.
+ * */
+struct MCSS_Coarse
+{
+	MCSS_Coarse() {}
+	MCSS_Coarse(const MCSS_Coarse &c);
+	MCSS_Coarse &operator=(const MCSS_Coarse &c);
+
+	Ptr<MCSS> model;
+};
+
+/* a run of equal non zero values on a row of the result */
+struct MCSS_Run
+{
+	int x, length;
+	uchar value;
 };
 
 /* moving cast shadow suppression */
@@ -51,17 +296,44 @@ class MCSS
 		MCSS();
 		/* update the model */
 		void operator()(Mat current, Mat background, Mat mask, OutputArray output);
+		/* update the model on the frame alone, with the built-in background model */
+		void operator()(Mat current, OutputArray output);
+		/* 
+		 * the same, the result is kept until it is fetched by one of the
+		 * get*Result below. It may refer to the mask, so fetch it before
+		 * changing the inputs.
+		 * */
+		void operator()(Mat current, Mat background, Mat mask);
+		void operator()(Mat current);
+		/* write the result mask (0, 127 shadow, 255 foreground) to the caller's buffer */
+		void getResult(uchar *data, size_t step) const;
+		/* 
+		 * write the result as 2-bit codes (0 background, 1 shadow, 2
+		 * foreground), 4 pixels a byte from the low bits, (width+3)/4 bytes a row
+		 * */
+		void getPackedResult(uchar *data, size_t step) const;
+		/* the runs of non zero values of each row, those of row i are runs[rowStart[i] .. rowStart[i+1]) */
+		void getResultRuns(vector<MCSS_Run> &runs, vector<int> &rowStart) const;
 		/* get some current parameters */
 		MCSS_Param getParameters();
 		/* set parameters */
 		void setParameters(MCSS_Param parameters);
+		/* timings and counters of the last frame */
+		const MCSS_Stats &getStats() const;
+		/* 
+		 * copy the intermediate results of each frame to a sink, which is
+		 * not owned and must outlive the model. NULL turns it off.
+		 * */
+		void setDiagnostics(MCSSDiagnostics *sink);
 
-		/* luminance ratio */
+		/* luminance ratio, CV_32FC3 or CV_16UC3 in fixed point */
 		Mat lumRatio;
-		/* label each pixel which LGC they belong */
+		/* label each pixel which LGC they belong, CV_32SC1 */
 		Mat lgcLabel;
 		/* result mask */
 		Mat dst;
+		/* background image and foreground mask of the built-in background model */
+		Mat bgImage, fgMask;
 
 	private:
 		int nframes;
@@ -82,6 +354,19 @@ class MCSS
 		Vec3f mgThrFixed;
 		/* indicate if the narrow bright fringe exist */
 		bool hasFringe;
+		/* compute the luminance ratio in fixed point */
+		bool isFixedPoint;
+		/* and the rest of the frame on integers too */
+		bool isIntegerOnly;
+		/* temporal reuse of the LGCs */
+		int reuseInterval;
+		float reuseMaxChange;
+		/* times the frames are halved in pyramid mode */
+		int pyramidLevels;
+		/* foreground test of the built-in background model */
+		float fgDeviation, fgMinDiff;
+		/* smallest connected region of the mask taken as an object, and the fringe erosion radius */
+		int minObjArea, fringeRadius;
 
 		/* check if each lgc belongs to shadow */
 		vector<bool> lgcIsShadow;
@@ -96,11 +381,12 @@ class MCSS
 		/* terminal pixel weight */
 		vector<float> tpw;
 
-		Mat lgcImg;
-		/* label each pixel which object they belong */
+		/* label each pixel which object they belong, CV_32SC1 */
 		Mat objLabel;
 		/* area of each object */
 		vector<int> objArea;
+		/* bounding box of each object */
+		vector<Rect> objBox;
 		/* area of each LGC */
 		vector<int> lgcArea;
 		/* record the object index of each lgc */
@@ -109,8 +395,33 @@ class MCSS
 		 * cont, mean, std
 		 * */
 		Mat cont, mean, STD;
+		/* per instance scratch memory */
+		MCSS_Scratch scratch;
+		MCSS_Stats stats;
+		/* the last frame, for the temporal reuse */
+		MCSS_History history;
+		/* diagnostics sink, NULL when off */
+		MCSSDiagnostics *diag;
+		/* model of the coarse level in pyramid mode, made by setParameters */
+		MCSS_Coarse coarse;
+		/* 
+		 * result of the last frame: dst, or the mask when there is nothing
+		 * to classify. Only when resultInRegions it is dst and zero outside
+		 * the regions, so those are all the encoders have to read.
+		 * */
+		Mat result;
+		bool resultInRegions;
+
+		void publishDiagnostics();
+		int findReusable();
+		int reuseLGC(int lgcNum);
+		void saveHistory();
+		void update(Mat current, Mat background, Mat mask, bool updateBackground);
+		void runPyramid(Mat current, Mat background, Mat mask);
+		void writeResult(OutputArray output) const;
+		void cloneBuffers();
 
-		int getNearestVal(Point pos);
+		friend struct MCSS_Coarse;
 };
 
 
@@ -0,0 +1,62 @@
+/*
+ * Diagnostics sink of the moving cast shadow suppression model
+ *
+ * */
+
+#include  "MCSSDiagnostics.h"
+
+MCSSDiagnostics::MCSSDiagnostics(int capacity, Size frameSize)
+	: ring(MAX(capacity, 1)+1), head(0), tail(0), dropped(0)
+{
+	for( size_t k = 0 ; k < ring.size() ; ++k )
+	{
+		MCSS_DiagFrame &frame = ring[k];
+		frame.frame = 0;
+		if( frameSize.area() > 0 )
+		{
+			frame.lumRatio.create(frameSize, CV_32FC3);
+			frame.lgcLabel.create(frameSize, CV_32SC1);
+		}
+	}
+}
+
+MCSS_DiagFrame *MCSSDiagnostics::beginWrite()
+{
+	size_t t = tail.load(std::memory_order_relaxed);
+	size_t next = t+1 == ring.size() ? 0 : t+1;
+
+	if( next == head.load(std::memory_order_acquire) )
+	{
+		dropped.fetch_add(1, std::memory_order_relaxed);
+		return NULL;
+	}
+	return &ring[t];
+}
+
+void MCSSDiagnostics::endWrite()
+{
+	size_t t = tail.load(std::memory_order_relaxed);
+
+	tail.store(t+1 == ring.size() ? 0 : t+1, std::memory_order_release);
+}
+
+const MCSS_DiagFrame *MCSSDiagnostics::beginRead()
+{
+	size_t h = head.load(std::memory_order_relaxed);
+
+	if( h == tail.load(std::memory_order_acquire) )
+		return NULL;
+	return &ring[h];
+}
+
+void MCSSDiagnostics::endRead()
+{
+	size_t h = head.load(std::memory_order_relaxed);
+
+	head.store(h+1 == ring.size() ? 0 : h+1, std::memory_order_release);
+}
+
+long MCSSDiagnostics::getDropped() const
+{
+	return dropped.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,77 @@
+#ifndef  __MCSS_DIAGNOSTICS_H__
+#define  __MCSS_DIAGNOSTICS_H__
+
+#include  <atomic>
+#include  "MCSS.h"
+
+/* frames the diagnostics ring holds by default */
+#define  DEFAULT_DIAG_CAPACITY	4
+
+/* one row of the LGC table */
+struct MCSS_LGCInfo
+{
+	int area;
+	/* object of the lgc, from 1 */
+	int object;
+	/* mean luminance ratio */
+	Vec3f mean;
+	/* terminal point weight, external / all terminal pixels */
+	float tpw;
+	int external, all;
+	bool isShadow;
+};
+
+/* intermediate results of one frame */
+struct MCSS_DiagFrame
+{
+	int frame;
+	/* luminance ratio, CV_32FC3 or CV_16UC3 in fixed point */
+	Mat lumRatio;
+	/* lgc label of each pixel */
+	Mat lgcLabel;
+	/* minimum gradient threshold of each object */
+	vector<Vec3f> mgThr;
+	/* the lgc regions, lgcs[i] has label i+1 */
+	vector<MCSS_LGCInfo> lgcs;
+	MCSS_Stats stats;
+};
+
+/* 
+ * diagnostics sink of a model (see MCSS::setDiagnostics). It is a ring of
+ * preallocated frames between the model's thread, which fills them, and
+ * one reader thread, which dumps or shows them. The model never waits:
+ * when the reader is behind and the ring is full the frame is dropped.
+ * */
+class MCSSDiagnostics
+{
+	public:
+		/* frameSize preallocates the images, else they are sized on the first frame */
+		explicit MCSSDiagnostics(int capacity = DEFAULT_DIAG_CAPACITY, Size frameSize = Size());
+
+		/* writer side: a free slot to fill, or NULL if the ring is full */
+		MCSS_DiagFrame *beginWrite();
+		/* publish the slot of beginWrite */
+		void endWrite();
+
+		/* reader side: the oldest frame, or NULL if there is none */
+		const MCSS_DiagFrame *beginRead();
+		/* give the frame of beginRead back to the writer */
+		void endRead();
+
+		/* number of frames dropped so far */
+		long getDropped() const;
+
+	private:
+		vector<MCSS_DiagFrame> ring;
+		/* the same single producer, single consumer indices as SPSCQueue */
+		alignas(64) std::atomic<size_t> head;
+		alignas(64) std::atomic<size_t> tail;
+		std::atomic<long> dropped;
+
+		/* not copyable */
+		MCSSDiagnostics(const MCSSDiagnostics &);
+		MCSSDiagnostics &operator=(const MCSSDiagnostics &);
+};
+
+
+#endif  /*__MCSS_DIAGNOSTICS_H__*/
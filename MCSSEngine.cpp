@@ -0,0 +1,334 @@
+/*
+ * A multi-stream scheduler for the moving cast shadow suppression model
+ *
+ * Every stream keeps its own MCSS model and its own frame queue, the
+ * workers take one frame of a stream per task and steal tasks from each
+ * other when their own queue runs dry.
+ *
+ * */
+
+#include  "MCSSEngine.h"
+
+/* one frame waiting to be processed */
+struct MCSSEngine::Job
+{
+	Mat current, background, mask;
+};
+
+/* one processed frame waiting to be fetched */
+struct MCSSEngine::Result
+{
+	Mat output;
+	/* empty unless the model failed on the frame */
+	string error;
+};
+
+struct MCSSEngine::Stream
+{
+	MCSS model;
+	std::mutex lock;
+	/* signaled when a result is ready or a slot becomes free */
+	std::condition_variable cond;
+	std::deque<Job> pending;
+	std::deque<Result> done;
+	/* frames submitted but not fetched yet */
+	int inFlight;
+	/* the stream is in a worker queue or being processed */
+	bool scheduled;
+
+	Stream() : inFlight(0), scheduled(false) {}
+};
+
+struct MCSSEngine::Worker
+{
+	std::mutex lock;
+	/* indices of the streams with a frame to process */
+	std::deque<int> tasks;
+	std::thread thread;
+};
+
+MCSSEngine::MCSSEngine(int nthreads, int queueSize)
+{
+	int i;
+
+	if( nthreads <= 0 )
+		nthreads = MAX(1, (int)std::thread::hardware_concurrency());
+	CV_Assert(queueSize > 0);
+	this->queueSize = queueSize;
+	queued = 0;
+	stopping = false;
+	nextWorker = 0;
+
+	for( i = 0 ; i < nthreads ; ++i )
+		workers.push_back(new Worker);
+	for( i = 0 ; i < nthreads ; ++i )
+		workers[i]->thread = std::thread(&MCSSEngine::workerLoop, this, i);
+}
+
+MCSSEngine::~MCSSEngine()
+{
+	size_t i;
+
+	/* the workers drain their queues before they leave */
+	{
+		std::lock_guard<std::mutex> guard(idleLock);
+		stopping = true;
+	}
+	idleCond.notify_all();
+	for( i = 0 ; i < workers.size() ; ++i )
+	{
+		workers[i]->thread.join();
+		delete workers[i];
+	}
+	for( i = 0 ; i < streams.size() ; ++i )
+		delete streams[i];
+}
+
+/**
+ * @brief addStream: create a new stream with the default parameters
+ *
+ * @return: index of the stream
+ */
+int MCSSEngine::addStream()
+{
+	std::lock_guard<std::mutex> guard(streamsLock);
+	streams.push_back(new Stream);
+	return (int)streams.size()-1;
+}
+
+/**
+ * @brief addStream: create a new stream
+ *
+ * @param parameters: parameters of the stream's model
+ *
+ * @return: index of the stream
+ */
+int MCSSEngine::addStream(MCSS_Param parameters)
+{
+	int stream = addStream();
+	getStream(stream)->model.setParameters(parameters);
+	return stream;
+}
+
+/**
+ * @brief submit: queue a frame of a stream
+ *
+ * @param stream: index of the stream
+ * @param current: the current frame
+ * @param background: the background image
+ * @param mask: mask image from any BS model
+ */
+void MCSSEngine::submit(int stream, Mat current, Mat background, Mat mask)
+{
+	Stream *s = getStream(stream);
+	bool needSchedule = false;
+	Job job;
+
+	job.current = current;
+	job.background = background;
+	job.mask = mask;
+	{
+		std::unique_lock<std::mutex> guard(s->lock);
+		/* backpressure: bound the latency of each stream */
+		while( s->inFlight >= queueSize )
+			s->cond.wait(guard);
+		s->pending.push_back(job);
+		++s->inFlight;
+		if( !s->scheduled )
+		{
+			s->scheduled = true;
+			needSchedule = true;
+		}
+	}
+	if( needSchedule )
+		schedule(stream, nextWorker++ % workers.size());
+}
+
+/**
+ * @brief fetch: get the next result of a stream
+ *
+ * @param stream: index of the stream
+ * @param output: the result mask image
+ * @param wait: block until the result is ready
+ * @param error: if not NULL, the reason a failed frame failed
+ *
+ * @return: MCSS_FETCH_NONE if nothing was fetched, MCSS_FETCH_FAILED if
+ *			the fetched frame failed
+ */
+MCSS_FetchResult MCSSEngine::fetch(int stream, Mat &output, bool wait, string *error)
+{
+	Stream *s = getStream(stream);
+	std::unique_lock<std::mutex> guard(s->lock);
+	bool failed;
+
+	while( wait && s->done.empty() && s->inFlight > 0 )
+		s->cond.wait(guard);
+	if( s->done.empty() )
+		return MCSS_FETCH_NONE;
+	Result &r = s->done.front();
+	failed = !r.error.empty();
+	output = r.output;
+	if( error )
+		*error = r.error;
+	s->done.pop_front();
+	--s->inFlight;
+	s->cond.notify_all();
+	return failed ? MCSS_FETCH_FAILED : MCSS_FETCH_OK;
+}
+
+/**
+ * @brief flush: wait until all the submitted frames have been processed
+ */
+void MCSSEngine::flush()
+{
+	int i, n = getNumStreams();
+
+	for( i = 0 ; i < n ; ++i )
+	{
+		Stream *s = getStream(i);
+		std::unique_lock<std::mutex> guard(s->lock);
+		while( s->scheduled )
+			s->cond.wait(guard);
+	}
+}
+
+int MCSSEngine::getNumThreads()
+{
+	return (int)workers.size();
+}
+
+int MCSSEngine::getNumStreams()
+{
+	std::lock_guard<std::mutex> guard(streamsLock);
+	return (int)streams.size();
+}
+
+MCSSEngine::Stream *MCSSEngine::getStream(int stream)
+{
+	std::lock_guard<std::mutex> guard(streamsLock);
+	CV_Assert(stream >= 0 && stream < (int)streams.size());
+	return streams[stream];
+}
+
+/**
+ * @brief schedule: put a stream in the queue of a worker
+ *
+ * @param stream: index of the stream
+ * @param worker: index of the worker
+ */
+void MCSSEngine::schedule(int stream, int worker)
+{
+	{
+		std::lock_guard<std::mutex> guard(workers[worker]->lock);
+		workers[worker]->tasks.push_back(stream);
+	}
+	{
+		std::lock_guard<std::mutex> guard(idleLock);
+		++queued;
+	}
+	idleCond.notify_one();
+}
+
+/**
+ * @brief takeTask: get a task from the worker's own queue, or steal one
+ *
+ * @param worker: index of the worker
+ * @param stream: index of the stream to process
+ *
+ * @return: false if all the queues are empty
+ */
+bool MCSSEngine::takeTask(int worker, int &stream)
+{
+	int i, n = (int)workers.size();
+
+	/* the own queue is served in order, so no stream waits behind the others */
+	for( i = 0 ; i < n ; ++i )
+	{
+		Worker *w = workers[(worker+i)%n];
+		std::lock_guard<std::mutex> guard(w->lock);
+		if( w->tasks.empty() )
+			continue;
+		/* the victims are robbed from the other end */
+		if( i == 0 )
+		{
+			stream = w->tasks.front();
+			w->tasks.pop_front();
+		}
+		else
+		{
+			stream = w->tasks.back();
+			w->tasks.pop_back();
+		}
+		std::lock_guard<std::mutex> idle(idleLock);
+		--queued;
+		return true;
+	}
+	return false;
+}
+
+/**
+ * @brief runTask: process one frame of a stream
+ *
+ * @param worker: index of the worker
+ * @param stream: index of the stream
+ */
+void MCSSEngine::runTask(int worker, int stream)
+{
+	Stream *s = getStream(stream);
+	bool more;
+	Result result;
+	Job job;
+
+	{
+		std::lock_guard<std::mutex> guard(s->lock);
+		job = s->pending.front();
+		s->pending.pop_front();
+	}
+
+	/*
+	 * only this worker touches the model until the stream is rescheduled.
+	 * A failure is handed to fetch, the caller decides what to report.
+	 * */
+	try
+	{
+		s->model(job.current, job.background, job.mask, result.output);
+	}
+	catch( const std::exception &e )
+	{
+		result.error = e.what();
+		if( result.error.empty() )
+			result.error = "unknown error";
+		result.output.release();
+	}
+
+	{
+		std::lock_guard<std::mutex> guard(s->lock);
+		s->done.push_back(result);
+		more = !s->pending.empty();
+		if( !more )
+			s->scheduled = false;
+		s->cond.notify_all();
+	}
+	/* the next frame goes to the back of our queue, behind the other streams */
+	if( more )
+		schedule(stream, worker);
+}
+
+void MCSSEngine::workerLoop(int worker)
+{
+	int stream;
+
+	while( 1 )
+	{
+		if( takeTask(worker, stream) )
+		{
+			runTask(worker, stream);
+			continue;
+		}
+		std::unique_lock<std::mutex> guard(idleLock);
+		while( !stopping && queued <= 0 )
+			idleCond.wait(guard);
+		if( stopping && queued <= 0 )
+			return;
+	}
+}
@@ -0,0 +1,95 @@
+#ifndef  __MCSS_ENGINE_H__
+#define  __MCSS_ENGINE_H__
+
+#include  <deque>
+#include  <vector>
+#include  <mutex>
+#include  <atomic>
+#include  <thread>
+#include  <condition_variable>
+#include  "MCSS.h"
+
+
+/* default number of frames a stream may have in flight */
+#define  DEFAULT_STREAM_QUEUE_SIZE	4
+
+/* what MCSSEngine::fetch took from a stream, false when it took nothing */
+enum MCSS_FetchResult
+{
+	/* nothing ready (wait == false) or nothing submitted (wait == true) */
+	MCSS_FETCH_NONE = 0,
+	MCSS_FETCH_OK,
+	/* the model threw on the frame, the output is empty */
+	MCSS_FETCH_FAILED
+};
+
+/*
+ * run the shadow suppression of many streams on a fixed pool of threads
+ *
+ * each stream owns its own MCSS model, so the background statistics of
+ * two cameras are never mixed. A stream is scheduled as one task per
+ * frame, a stream never has two frames running at the same time, and its
+ * results are fetched in the order the frames were submitted. Idle workers
+ * steal tasks from the busy ones.
+ * */
+class MCSSEngine
+{
+	public:
+		/* nthreads <= 0 starts one worker per cpu core */
+		MCSSEngine(int nthreads = 0, int queueSize = DEFAULT_STREAM_QUEUE_SIZE);
+		~MCSSEngine();
+
+		/* create a new stream, return its index */
+		int addStream();
+		int addStream(MCSS_Param parameters);
+		/*
+		 * queue a frame of a stream, the engine keeps a reference to the
+		 * matrices until the frame is processed, so don't write into them.
+		 * Blocks while the stream has queueSize frames not fetched yet.
+		 * */
+		void submit(int stream, Mat current, Mat background, Mat mask);
+		/*
+		 * get the next result of a stream. A frame that failed still takes
+		 * its turn: it gives MCSS_FETCH_FAILED, an empty output and, if
+		 * error isn't NULL, the reason.
+		 * */
+		MCSS_FetchResult fetch(int stream, Mat &output, bool wait = true, string *error = NULL);
+		/* wait until all the submitted frames have been processed */
+		void flush();
+
+		int getNumThreads();
+		int getNumStreams();
+
+	private:
+		struct Job;
+		struct Result;
+		struct Stream;
+		struct Worker;
+
+		vector<Worker *> workers;
+		vector<Stream *> streams;
+		/* protect the stream list */
+		std::mutex streamsLock;
+		/* idle workers sleep here */
+		std::mutex idleLock;
+		std::condition_variable idleCond;
+		/* number of tasks in all the worker queues */
+		int queued;
+		bool stopping;
+		/* spread the new tasks over the workers */
+		std::atomic<unsigned> nextWorker;
+		int queueSize;
+
+		Stream *getStream(int stream);
+		void schedule(int stream, int worker);
+		bool takeTask(int worker, int &stream);
+		void runTask(int worker, int stream);
+		void workerLoop(int worker);
+
+		/* not copyable */
+		MCSSEngine(const MCSSEngine &);
+		MCSSEngine &operator=(const MCSSEngine &);
+};
+
+
+#endif  /*__MCSS_ENGINE_H__*/
@@ -0,0 +1,512 @@
+/*
+ * Vectorized row kernels of the moving cast shadow suppression model
+ *
+ * The x86 versions are compiled with per function target attributes,
+ * so the library still runs on any cpu and picks the best one at runtime.
+ *
+ * */
+
+#include  <cmath>
+#include  <cstring>
+#include  <climits>
+#include  <cstdlib>
+#include  "MCSSKernels.h"
+
+#if !defined(MCSS_NO_SIMD) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define  MCSS_X86_SIMD
+#include  <immintrin.h>
+#define  MCSS_TARGET(isa)	__attribute__((target(isa)))
+#endif
+
+typedef void (*LumRatioRowFunc)(const uchar *, const uchar *, const uchar *, float, float *, uchar *, int);
+typedef void (*BackgroundElemsFunc)(const uchar *, const float *, float *, float *, int);
+typedef void (*BackgroundElemsFixedFunc)(const uchar *, const short *, short *, short *, int, int);
+
+/* pixels of a row backgroundRow hands to the element kernel at once */
+#define  BACKGROUND_CHUNK	256
+
+/**
+ * @brief lumRatioRowScalar: plain C++ version of lumRatioRow, also used for the row tails
+ */
+static void lumRatioRowScalar(const uchar *current, const uchar *background, const uchar *post,
+		float v, float *ratio, uchar *dst, int width)
+{
+	int j;
+
+	for( j = 0 ; j < width ; ++j, current += 3, background += 3, ratio += 3 )
+	{
+		if( post[j] != 255 )
+		{
+			dst[j] = post[j];
+			ratio[0] = ratio[1] = ratio[2] = 0;
+			continue;
+		}
+		ratio[0] = (background[0]+v)/(current[0]+v);
+		ratio[1] = (background[1]+v)/(current[1]+v);
+		ratio[2] = (background[2]+v)/(current[2]+v);
+		/* Shadow like area */
+		if( ratio[0] >= 1 && ratio[1] >= 1 && ratio[2] >= 1 )
+			dst[j] = 127;
+		/* foreground pixel */
+		else
+		{
+			ratio[0] = ratio[1] = ratio[2] = 0;
+			dst[j] = 255;
+		}
+	}
+}
+
+/**
+ * @brief backgroundElemsScalar: plain C++ version of the background statistics
+ *								 update, also used for the tails
+ *
+ * @param current: channel values of the current frame
+ * @param count: frame count of each channel value, 0 to leave it as it is
+ * @param mean: running mean of each channel value
+ * @param std: running mean absolute deviation of each channel value
+ * @param len: number of channel values
+ */
+static void backgroundElemsScalar(const uchar *current, const float *count,
+		float *mean, float *std, int len)
+{
+	int k;
+
+	for( k = 0 ; k < len ; ++k )
+	{
+		float n = count[k];
+		if( n == 0 )
+			continue;
+		mean[k] = (n-1)*mean[k]/n+floorf(current[k]/n);
+		std[k] = (n-1)*std[k]/n+fabsf(current[k]-mean[k])/n;
+	}
+}
+
+/**
+ * @brief mulRound: a*w/2^15 rounded, what pmulhrsw does on each lane
+ */
+static inline int mulRound(int a, int w)
+{
+	return (a*w+(1 << 14)) >> 15;
+}
+
+/**
+ * @brief backgroundElemsFixedScalar: plain C++ version of the fixed point
+ *									  background statistics update, also used for the tails
+ *
+ * @param current: channel values of the current frame
+ * @param weight: 2^15/n of each channel value, 0 to leave it as it is
+ * @param mean: running mean of each channel value
+ * @param std: running mean absolute deviation of each channel value
+ * @param len: number of channel values
+ * @param shift: fractional bits of mean and std
+ */
+static void backgroundElemsFixedScalar(const uchar *current, const short *weight,
+		short *mean, short *std, int len, int shift)
+{
+	int k;
+
+	for( k = 0 ; k < len ; ++k )
+	{
+		int c = current[k] << shift;
+		mean[k] += mulRound(c-mean[k], weight[k]);
+		std[k] += mulRound(abs(c-mean[k])-std[k], weight[k]);
+	}
+}
+
+#ifdef MCSS_X86_SIMD
+
+/* gather the first byte of each of 16 BGR pixels spread over 3 registers */
+static const signed char gather0[16] = {0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1};
+static const signed char gather1[16] = {-1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14, -1, -1, -1, -1, -1};
+static const signed char gather2[16] = {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, 4, 7, 10, 13};
+/* spread 16 per pixel bytes back over the 3 channels */
+static const signed char spread0[16] = {0, 0, 0, 1, 1, 1, 2, 2, 2, 3, 3, 3, 4, 4, 4, 5};
+static const signed char spread1[16] = {5, 5, 6, 6, 6, 7, 7, 7, 8, 8, 8, 9, 9, 9, 10, 10};
+static const signed char spread2[16] = {10, 11, 11, 11, 12, 12, 12, 13, 13, 13, 14, 14, 14, 15, 15, 15};
+
+/**
+ * @brief classify16: shadow test of 16 pixels
+ *
+ * (bg+v)/(cur+v) >= 1 holds exactly when bg >= cur, so the test is done
+ * on the bytes. dst is written, keep[] gets a byte mask of the channels
+ * whose ratio is kept.
+ */
+MCSS_TARGET("sse4.1") static inline void classify16(const uchar *current, const uchar *background,
+		const uchar *post, uchar *dst, __m128i keep[3])
+{
+	__m128i b0 = _mm_loadu_si128((const __m128i *)background);
+	__m128i b1 = _mm_loadu_si128((const __m128i *)(background+16));
+	__m128i b2 = _mm_loadu_si128((const __m128i *)(background+32));
+	__m128i c0 = _mm_loadu_si128((const __m128i *)current);
+	__m128i c1 = _mm_loadu_si128((const __m128i *)(current+16));
+	__m128i c2 = _mm_loadu_si128((const __m128i *)(current+32));
+	/* bg >= cur for each channel */
+	__m128i g0 = _mm_cmpeq_epi8(_mm_max_epu8(b0, c0), b0);
+	__m128i g1 = _mm_cmpeq_epi8(_mm_max_epu8(b1, c1), b1);
+	__m128i g2 = _mm_cmpeq_epi8(_mm_max_epu8(b2, c2), b2);
+	/* and the 3 channels of a pixel into its first byte */
+	__m128i a0 = _mm_and_si128(g0, _mm_and_si128(_mm_alignr_epi8(g1, g0, 1), _mm_alignr_epi8(g1, g0, 2)));
+	__m128i a1 = _mm_and_si128(g1, _mm_and_si128(_mm_alignr_epi8(g2, g1, 1), _mm_alignr_epi8(g2, g1, 2)));
+	__m128i a2 = _mm_and_si128(g2, _mm_and_si128(_mm_srli_si128(g2, 1), _mm_srli_si128(g2, 2)));
+	__m128i shadow = _mm_or_si128(_mm_or_si128(
+				_mm_shuffle_epi8(a0, _mm_loadu_si128((const __m128i *)gather0)),
+				_mm_shuffle_epi8(a1, _mm_loadu_si128((const __m128i *)gather1))),
+			_mm_shuffle_epi8(a2, _mm_loadu_si128((const __m128i *)gather2)));
+	__m128i p = _mm_loadu_si128((const __m128i *)post);
+	__m128i k = _mm_and_si128(_mm_cmpeq_epi8(p, _mm_set1_epi8(-1)), shadow);
+
+	/* 255 ^ 0x80 = 127 for the shadow like pixels, the rest keeps post */
+	_mm_storeu_si128((__m128i *)dst, _mm_xor_si128(p, _mm_and_si128(k, _mm_set1_epi8((char)0x80))));
+	keep[0] = _mm_shuffle_epi8(k, _mm_loadu_si128((const __m128i *)spread0));
+	keep[1] = _mm_shuffle_epi8(k, _mm_loadu_si128((const __m128i *)spread1));
+	keep[2] = _mm_shuffle_epi8(k, _mm_loadu_si128((const __m128i *)spread2));
+}
+
+MCSS_TARGET("sse4.1") static void lumRatioRowSSE41(const uchar *current, const uchar *background,
+		const uchar *post, float v, float *ratio, uchar *dst, int width)
+{
+	int j, k, q;
+	__m128 vv = _mm_set1_ps(v);
+	__m128i keep[3];
+
+	for( j = 0 ; j <= width-16 ; j += 16 )
+	{
+		const uchar *c = current+j*3, *b = background+j*3;
+		float *r = ratio+j*3;
+		classify16(c, b, post+j, dst+j, keep);
+		for( k = 0 ; k < 3 ; ++k )
+		{
+			__m128i bk = _mm_loadu_si128((const __m128i *)(b+16*k));
+			__m128i ck = _mm_loadu_si128((const __m128i *)(c+16*k));
+			for( q = 0 ; q < 4 ; ++q )
+			{
+				__m128 num = _mm_add_ps(_mm_cvtepi32_ps(_mm_cvtepu8_epi32(bk)), vv);
+				__m128 den = _mm_add_ps(_mm_cvtepi32_ps(_mm_cvtepu8_epi32(ck)), vv);
+				__m128 m = _mm_castsi128_ps(_mm_cvtepi8_epi32(keep[k]));
+				_mm_storeu_ps(r+16*k+4*q, _mm_and_ps(_mm_div_ps(num, den), m));
+				bk = _mm_srli_si128(bk, 4);
+				ck = _mm_srli_si128(ck, 4);
+				keep[k] = _mm_srli_si128(keep[k], 4);
+			}
+		}
+	}
+	lumRatioRowScalar(current+j*3, background+j*3, post+j, v, ratio+j*3, dst+j, width-j);
+}
+
+MCSS_TARGET("avx2") static void lumRatioRowAVX2(const uchar *current, const uchar *background,
+		const uchar *post, float v, float *ratio, uchar *dst, int width)
+{
+	int j, k, q;
+	__m256 vv = _mm256_set1_ps(v);
+	__m128i keep[3];
+
+	for( j = 0 ; j <= width-16 ; j += 16 )
+	{
+		const uchar *c = current+j*3, *b = background+j*3;
+		float *r = ratio+j*3;
+		classify16(c, b, post+j, dst+j, keep);
+		for( k = 0 ; k < 3 ; ++k )
+		{
+			__m128i bk = _mm_loadu_si128((const __m128i *)(b+16*k));
+			__m128i ck = _mm_loadu_si128((const __m128i *)(c+16*k));
+			for( q = 0 ; q < 2 ; ++q )
+			{
+				__m256 num = _mm256_add_ps(_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(bk)), vv);
+				__m256 den = _mm256_add_ps(_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(ck)), vv);
+				__m256 m = _mm256_castsi256_ps(_mm256_cvtepi8_epi32(keep[k]));
+				_mm256_storeu_ps(r+16*k+8*q, _mm256_and_ps(_mm256_div_ps(num, den), m));
+				bk = _mm_srli_si128(bk, 8);
+				ck = _mm_srli_si128(ck, 8);
+				keep[k] = _mm_srli_si128(keep[k], 8);
+			}
+		}
+	}
+	lumRatioRowScalar(current+j*3, background+j*3, post+j, v, ratio+j*3, dst+j, width-j);
+}
+
+/* the same operations in the same order as backgroundElemsScalar, so the results are the same */
+MCSS_TARGET("sse4.1") static void backgroundElemsSSE41(const uchar *current, const float *count,
+		float *mean, float *std, int len)
+{
+	int k, bytes;
+	__m128 one = _mm_set1_ps(1), zero = _mm_setzero_ps();
+	__m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+
+	for( k = 0 ; k <= len-4 ; k += 4 )
+	{
+		__m128 n = _mm_loadu_ps(count+k);
+		__m128 skip = _mm_cmpeq_ps(n, zero);
+		/* 1 instead of 0, the skipped lanes are thrown away anyway */
+		n = _mm_blendv_ps(n, one, skip);
+		memcpy(&bytes, current+k, 4);
+		__m128 c = _mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(bytes)));
+		__m128 m = _mm_loadu_ps(mean+k), s = _mm_loadu_ps(std+k);
+		__m128 n1 = _mm_sub_ps(n, one);
+		__m128 m2 = _mm_add_ps(_mm_div_ps(_mm_mul_ps(n1, m), n), _mm_floor_ps(_mm_div_ps(c, n)));
+		__m128 s2 = _mm_add_ps(_mm_div_ps(_mm_mul_ps(n1, s), n),
+				_mm_div_ps(_mm_and_ps(_mm_sub_ps(c, m2), absMask), n));
+		_mm_storeu_ps(mean+k, _mm_blendv_ps(m2, m, skip));
+		_mm_storeu_ps(std+k, _mm_blendv_ps(s2, s, skip));
+	}
+	backgroundElemsScalar(current+k, count+k, mean+k, std+k, len-k);
+}
+
+MCSS_TARGET("avx2") static void backgroundElemsAVX2(const uchar *current, const float *count,
+		float *mean, float *std, int len)
+{
+	int k;
+	__m256 one = _mm256_set1_ps(1), zero = _mm256_setzero_ps();
+	__m256 absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+
+	for( k = 0 ; k <= len-8 ; k += 8 )
+	{
+		__m256 n = _mm256_loadu_ps(count+k);
+		__m256 skip = _mm256_cmp_ps(n, zero, _CMP_EQ_OQ);
+		n = _mm256_blendv_ps(n, one, skip);
+		__m256 c = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(current+k))));
+		__m256 m = _mm256_loadu_ps(mean+k), s = _mm256_loadu_ps(std+k);
+		__m256 n1 = _mm256_sub_ps(n, one);
+		__m256 m2 = _mm256_add_ps(_mm256_div_ps(_mm256_mul_ps(n1, m), n), _mm256_floor_ps(_mm256_div_ps(c, n)));
+		__m256 s2 = _mm256_add_ps(_mm256_div_ps(_mm256_mul_ps(n1, s), n),
+				_mm256_div_ps(_mm256_and_ps(_mm256_sub_ps(c, m2), absMask), n));
+		_mm256_storeu_ps(mean+k, _mm256_blendv_ps(m2, m, skip));
+		_mm256_storeu_ps(std+k, _mm256_blendv_ps(s2, s, skip));
+	}
+	backgroundElemsScalar(current+k, count+k, mean+k, std+k, len-k);
+}
+
+/* the same rounding as backgroundElemsFixedScalar, so the results are the same */
+MCSS_TARGET("sse4.1") static void backgroundElemsFixedSSE41(const uchar *current, const short *weight,
+		short *mean, short *std, int len, int shift)
+{
+	int k;
+	__m128i count = _mm_cvtsi32_si128(shift);
+
+	for( k = 0 ; k <= len-8 ; k += 8 )
+	{
+		__m128i c = _mm_sll_epi16(_mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i *)(current+k))), count);
+		__m128i w = _mm_loadu_si128((const __m128i *)(weight+k));
+		__m128i m = _mm_loadu_si128((const __m128i *)(mean+k));
+		__m128i s = _mm_loadu_si128((const __m128i *)(std+k));
+		m = _mm_add_epi16(m, _mm_mulhrs_epi16(_mm_sub_epi16(c, m), w));
+		s = _mm_add_epi16(s, _mm_mulhrs_epi16(_mm_sub_epi16(_mm_abs_epi16(_mm_sub_epi16(c, m)), s), w));
+		_mm_storeu_si128((__m128i *)(mean+k), m);
+		_mm_storeu_si128((__m128i *)(std+k), s);
+	}
+	backgroundElemsFixedScalar(current+k, weight+k, mean+k, std+k, len-k, shift);
+}
+
+MCSS_TARGET("avx2") static void backgroundElemsFixedAVX2(const uchar *current, const short *weight,
+		short *mean, short *std, int len, int shift)
+{
+	int k;
+	__m128i count = _mm_cvtsi32_si128(shift);
+
+	for( k = 0 ; k <= len-16 ; k += 16 )
+	{
+		__m256i c = _mm256_sll_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(current+k))), count);
+		__m256i w = _mm256_loadu_si256((const __m256i *)(weight+k));
+		__m256i m = _mm256_loadu_si256((const __m256i *)(mean+k));
+		__m256i s = _mm256_loadu_si256((const __m256i *)(std+k));
+		m = _mm256_add_epi16(m, _mm256_mulhrs_epi16(_mm256_sub_epi16(c, m), w));
+		s = _mm256_add_epi16(s, _mm256_mulhrs_epi16(_mm256_sub_epi16(_mm256_abs_epi16(_mm256_sub_epi16(c, m)), s), w));
+		_mm256_storeu_si256((__m256i *)(mean+k), m);
+		_mm256_storeu_si256((__m256i *)(std+k), s);
+	}
+	backgroundElemsFixedScalar(current+k, weight+k, mean+k, std+k, len-k, shift);
+}
+
+#endif
+
+/**
+ * @brief selectLumRatioRow: pick the best lumRatioRow for this cpu
+ */
+static LumRatioRowFunc selectLumRatioRow(const char **name)
+{
+#ifdef MCSS_X86_SIMD
+	__builtin_cpu_init();
+	if( __builtin_cpu_supports("avx2") )
+	{
+		*name = "avx2";
+		return lumRatioRowAVX2;
+	}
+	if( __builtin_cpu_supports("sse4.1") )
+	{
+		*name = "sse4.1";
+		return lumRatioRowSSE41;
+	}
+#endif
+	*name = "scalar";
+	return lumRatioRowScalar;
+}
+
+static BackgroundElemsFunc selectBackgroundElems()
+{
+#ifdef MCSS_X86_SIMD
+	__builtin_cpu_init();
+	if( __builtin_cpu_supports("avx2") )
+		return backgroundElemsAVX2;
+	if( __builtin_cpu_supports("sse4.1") )
+		return backgroundElemsSSE41;
+#endif
+	return backgroundElemsScalar;
+}
+
+static BackgroundElemsFixedFunc selectBackgroundElemsFixed()
+{
+#ifdef MCSS_X86_SIMD
+	__builtin_cpu_init();
+	if( __builtin_cpu_supports("avx2") )
+		return backgroundElemsFixedAVX2;
+	if( __builtin_cpu_supports("sse4.1") )
+		return backgroundElemsFixedSSE41;
+#endif
+	return backgroundElemsFixedScalar;
+}
+
+/**
+ * @brief buildFixedWeights: the weight 2^15/n of backgroundRowFixed for each frame count n
+ */
+static const short *buildFixedWeights()
+{
+	static short weights[256];
+	int n;
+
+	weights[0] = 0;
+	/* 2^15 doesn't fit, the first frame is within a unit of the value */
+	weights[1] = SHRT_MAX;
+	for( n = 2 ; n < 256 ; ++n )
+		weights[n] = (short)(((1 << 15)+n/2)/n);
+	return weights;
+}
+
+static const char *lumRatioName = NULL;
+
+static LumRatioRowFunc getLumRatioRow()
+{
+	/* chosen once, thread safe */
+	static const LumRatioRowFunc func = selectLumRatioRow(&lumRatioName);
+	return func;
+}
+
+void lumRatioRow(const uchar *current, const uchar *background, const uchar *post,
+		float v, float *ratio, uchar *dst, int width)
+{
+	getLumRatioRow()(current, background, post, v, ratio, dst, width);
+}
+
+void lumRatioRowLUT(const uchar *current, const uchar *background, const uchar *post,
+		const ushort *table, ushort *ratio, uchar *dst, int width)
+{
+	int j;
+
+	/* the gathers don't vectorize, one lookup per channel is already cheaper than a division */
+	for( j = 0 ; j < width ; ++j, current += 3, background += 3, ratio += 3 )
+	{
+		if( post[j] == 255 && background[0] >= current[0] &&
+				background[1] >= current[1] && background[2] >= current[2] )
+		{
+			ratio[0] = table[background[0]*256+current[0]];
+			ratio[1] = table[background[1]*256+current[1]];
+			ratio[2] = table[background[2]*256+current[2]];
+			dst[j] = 127;
+			continue;
+		}
+		/* foreground (255) or outside the objects, either way post is the answer */
+		dst[j] = post[j];
+		ratio[0] = ratio[1] = ratio[2] = 0;
+	}
+}
+
+void backgroundRow(const uchar *current, const uchar *objMask, uchar *cont,
+		float *mean, float *std, int width, int history)
+{
+	static const BackgroundElemsFunc elems = selectBackgroundElems();
+	float count[3*BACKGROUND_CHUNK];
+	int j, k, len;
+
+	for( j = 0 ; j < width ; j += len )
+	{
+		len = MIN(width-j, BACKGROUND_CHUNK);
+		for( k = 0 ; k < len ; ++k )
+		{
+			int n = 0;
+			if( objMask[j+k] == 0 )
+			{
+				n = cont[j+k]+1;
+				if( n < history )
+					++cont[j+k];
+			}
+			count[3*k] = count[3*k+1] = count[3*k+2] = n;
+		}
+		elems(current+3*j, count, mean+3*j, std+3*j, 3*len);
+	}
+}
+
+void backgroundRowFixed(const uchar *current, const uchar *objMask, uchar *cont,
+		short *mean, short *std, int width, int history, int shift)
+{
+	static const BackgroundElemsFixedFunc elems = selectBackgroundElemsFixed();
+	static const short *weights = buildFixedWeights();
+	short weight[3*BACKGROUND_CHUNK];
+	int j, k, len;
+
+	for( j = 0 ; j < width ; j += len )
+	{
+		len = MIN(width-j, BACKGROUND_CHUNK);
+		for( k = 0 ; k < len ; ++k )
+		{
+			int n = 0;
+			if( objMask[j+k] == 0 )
+			{
+				n = cont[j+k]+1;
+				if( n < history )
+					++cont[j+k];
+			}
+			weight[3*k] = weight[3*k+1] = weight[3*k+2] = weights[n];
+		}
+		elems(current+3*j, weight, mean+3*j, std+3*j, 3*len, shift);
+	}
+}
+
+void foregroundRow(const uchar *current, const uchar *cont, const float *mean, const float *std,
+		uchar *mask, uchar *background, int width, float deviation, float minDiff)
+{
+	int j, k;
+
+	for( j = 0 ; j < width ; ++j, current += 3, mean += 3, std += 3, background += 3 )
+	{
+		bool fg = false;
+		for( k = 0 ; k < 3 ; ++k )
+		{
+			float diff = fabsf(current[k]-mean[k]);
+			fg = fg || diff > MAX(deviation*std[k], minDiff);
+			background[k] = cv::saturate_cast<uchar>(mean[k]);
+		}
+		mask[j] = cont[j] > 0 && fg ? 255 : 0;
+	}
+}
+
+void foregroundRowFixed(const uchar *current, const uchar *cont, const short *mean, const short *std,
+		uchar *mask, uchar *background, int width, int deviation, int minDiff, int shift)
+{
+	int j, k;
+
+	for( j = 0 ; j < width ; ++j, current += 3, mean += 3, std += 3, background += 3 )
+	{
+		bool fg = false;
+		for( k = 0 ; k < 3 ; ++k )
+		{
+			int diff = abs((current[k] << shift)-mean[k]);
+			fg = fg || diff > MAX((deviation*std[k]) >> 8, minDiff);
+			background[k] = (uchar)((mean[k]+(1 << shift >> 1)) >> shift);
+		}
+		mask[j] = cont[j] > 0 && fg ? 255 : 0;
+	}
+}
+
+const char *lumRatioKernelName()
+{
+	getLumRatioRow();
+	return lumRatioName;
+}
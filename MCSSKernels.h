@@ -0,0 +1,74 @@
+#ifndef  __MCSS_KERNELS_H__
+#define  __MCSS_KERNELS_H__
+
+#include  <opencv2/opencv.hpp>
+
+/*
+ * row kernels of the per-pixel passes, dispatched at runtime to the
+ * widest instruction set of the cpu (AVX2, SSE4.1 or plain C++).
+ * Build with -DMCSS_NO_SIMD to keep only the scalar versions.
+ * */
+
+/*
+ * luminance ratio and shadow candidates of one row
+ * (Part III. MOVING SHADOW DETECTION ,C. Regions with Local Color Constancy)
+ *
+ * where post is 255 the ratio (bg+v)/(cur+v) of each channel is computed,
+ * a pixel with all the ratios >= 1 is shadow like (dst = 127) and keeps
+ * them, any other one is foreground (dst = 255) and gets a zero ratio.
+ * Elsewhere dst is a copy of post and the ratio is zero.
+ * */
+void lumRatioRow(const uchar *current, const uchar *background, const uchar *post,
+		float v, float *ratio, uchar *dst, int width);
+
+/*
+ * same as lumRatioRow with the ratio in 16-bit fixed point, looked up in
+ * table[background*256+current]. The shadow test is exact as it is done
+ * on the bytes, so dst is the same as lumRatioRow's.
+ * */
+void lumRatioRowLUT(const uchar *current, const uchar *background, const uchar *post,
+		const ushort *table, ushort *ratio, uchar *dst, int width);
+
+/*
+ * background statistics of one row, for the adaptive minimum gradient
+ * threshold. Where objMask is 0 the pixel's frame count n (cont+1, cont
+ * stops at history-1) gives the running mean and mean absolute deviation
+ *   mean = (n-1)*mean/n+floor(cur/n),  std = ((n-1)*std+|cur-mean|)/n
+ * of each channel, the object pixels keep theirs. cur/n is rounded down
+ * as the integer division of the original model did, exact in float for
+ * cur <= 255 and n <= 255.
+ * */
+void backgroundRow(const uchar *current, const uchar *objMask, uchar *cont,
+		float *mean, float *std, int width, int history);
+
+/*
+ * foreground mask of one row against the background statistics: a pixel
+ * already seen as background (cont > 0) is foreground (255) if one of its
+ * channels is further than max(deviation*std, minDiff) from the mean,
+ * else 0. background gets the rounded mean.
+ * */
+void foregroundRow(const uchar *current, const uchar *cont, const float *mean, const float *std,
+		uchar *mask, uchar *background, int width, float deviation, float minDiff);
+
+/*
+ * same as backgroundRow with the statistics in 16-bit fixed point with
+ * shift (at most 7) fractional bits. Each step is rounded:
+ *   mean += round((cur-mean)*w),  std += round((|cur-mean|-std)*w)
+ * with w = round(2^15/n)/2^15 (2^15-1 for n = 1), which every instruction
+ * set computes the same way, so the results don't depend on the cpu.
+ * */
+void backgroundRowFixed(const uchar *current, const uchar *objMask, uchar *cont,
+		short *mean, short *std, int width, int history, int shift);
+
+/*
+ * same as foregroundRow on the statistics of backgroundRowFixed,
+ * deviation has 8 fractional bits and minDiff the statistics' shift
+ * */
+void foregroundRowFixed(const uchar *current, const uchar *cont, const short *mean, const short *std,
+		uchar *mask, uchar *background, int width, int deviation, int minDiff, int shift);
+
+/* name of the implementation lumRatioRow runs */
+const char *lumRatioKernelName();
+
+
+#endif  /*__MCSS_KERNELS_H__*/
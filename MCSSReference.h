@@ -0,0 +1,30 @@
+#ifndef  __MCSS_REFERENCE_H__
+#define  __MCSS_REFERENCE_H__
+
+#include  <opencv2/opencv.hpp>
+
+
+/*
+ * the model as it was before the performance work, see MCSSReference.cpp.
+ * It only takes the two switches of the original, the thresholds are its
+ * defaults, which are still the defaults of MCSS.
+ * */
+class MCSSReference
+{
+	public:
+		MCSSReference(bool isMGThrFixed, bool hasFringe);
+		~MCSSReference();
+		void operator()(const cv::Mat &current, const cv::Mat &background,
+				const cv::Mat &mask, cv::Mat &output);
+
+	private:
+		struct Model;
+		Model *model;
+
+		/* not copyable */
+		MCSSReference(const MCSSReference &);
+		MCSSReference &operator=(const MCSSReference &);
+};
+
+
+#endif  /*__MCSS_REFERENCE_H__*/
@@ -0,0 +1,220 @@
+/*
+ * C interface of the moving cast shadow suppression model
+ *
+ * The caller's buffers are wrapped in matrices that point into them, so
+ * the frame and the background go through the model without a copy, and
+ * the result is written by the encoders straight into the caller's
+ * buffer.
+ *
+ * */
+
+#include  "MCSS_C.h"
+#include  "MCSS.h"
+
+struct MCSS_Handle
+{
+	MCSS model;
+	string error;
+};
+
+/**
+ * @brief checkFrame: check the buffers of a frame
+ *
+ * @param width: frame width
+ * @param height: frame height
+ * @param format: MCSS_RESULT_MASK or MCSS_RESULT_PACKED
+ * @param frame: the frame
+ *
+ * @return: NULL if it is fine, else what is wrong
+ */
+static const char *checkFrame(int width, int height, int format, const MCSS_CFrame *frame)
+{
+	if( width <= 0 || height <= 0 )
+		return "the frame size must be positive";
+	if( format != MCSS_RESULT_MASK && format != MCSS_RESULT_PACKED )
+		return "unknown result format";
+	if( frame == NULL || frame->current == NULL || frame->result == NULL )
+		return "the frame and its result can't be NULL";
+	if( (frame->background == NULL) != (frame->mask == NULL) )
+		return "give both the background and the mask, or neither of them";
+	if( frame->currentStep < (size_t)width*3 )
+		return "current row stride is shorter than a row";
+	if( frame->background != NULL && (frame->backgroundStep < (size_t)width*3 || frame->maskStep < (size_t)width) )
+		return "background or mask row stride is shorter than a row";
+	if( frame->resultStep < (size_t)(format == MCSS_RESULT_PACKED ? (width+3)/4 : width) )
+		return "result row stride is shorter than a row";
+	return NULL;
+}
+
+/**
+ * @brief processFrame: run the model on a checked frame and write its result
+ *
+ * @param handle: the model
+ * @param width: frame width
+ * @param height: frame height
+ * @param format: MCSS_RESULT_MASK or MCSS_RESULT_PACKED
+ * @param frame: the frame
+ *
+ * @return: MCSS_OK or MCSS_ERROR_MODEL
+ */
+static int processFrame(MCSS_Handle *handle, int width, int height, int format, const MCSS_CFrame *frame)
+{
+	try
+	{
+		/* the model only reads the inputs, the const goes for the matrix headers */
+		Mat current(height, width, CV_8UC3, (void *)frame->current, frame->currentStep);
+		if( frame->mask == NULL )
+			handle->model(current);
+		else
+		{
+			Mat background(height, width, CV_8UC3, (void *)frame->background, frame->backgroundStep);
+			Mat mask(height, width, CV_8UC1, (void *)frame->mask, frame->maskStep);
+			handle->model(current, background, mask);
+		}
+		if( format == MCSS_RESULT_PACKED )
+			handle->model.getPackedResult(frame->result, frame->resultStep);
+		else
+			handle->model.getResult(frame->result, frame->resultStep);
+	}
+	catch( const std::exception &e )
+	{
+		handle->error = e.what();
+		return MCSS_ERROR_MODEL;
+	}
+	catch( ... )
+	{
+		handle->error = "unknown error";
+		return MCSS_ERROR_MODEL;
+	}
+	return MCSS_OK;
+}
+
+int mcss_api_version(void)
+{
+	return MCSS_C_API_VERSION;
+}
+
+MCSS_Handle *mcss_create(void)
+{
+	try
+	{
+		return new MCSS_Handle;
+	}
+	catch( ... )
+	{
+		return NULL;
+	}
+}
+
+void mcss_destroy(MCSS_Handle *handle)
+{
+	delete handle;
+}
+
+int mcss_get_parameters(MCSS_Handle *handle, MCSS_CParam *param)
+{
+	if( handle == NULL || param == NULL )
+		return MCSS_ERROR_ARGUMENT;
+	MCSS_Param p = handle->model.getParameters();
+	param->threshold1 = p.threshold1;
+	param->threshold2 = p.threshold2;
+	param->lambda_low = p.lambda_low;
+	param->lambda_high = p.lambda_high;
+	param->tao = p.tao;
+	param->alpha = p.alpha;
+	param->mgThrFixed[0] = p.mgThrFixed[0];
+	param->mgThrFixed[1] = p.mgThrFixed[1];
+	param->mgThrFixed[2] = p.mgThrFixed[2];
+	param->isMGThrFixed = p.isMGThrFixed;
+	param->hasFringe = p.hasFringe;
+	param->isFixedPoint = p.isFixedPoint;
+	param->isIntegerOnly = p.isIntegerOnly;
+	param->reuseInterval = p.reuseInterval;
+	param->reuseMaxChange = p.reuseMaxChange;
+	param->pyramidLevels = p.pyramidLevels;
+	param->fgDeviation = p.fgDeviation;
+	param->fgMinDiff = p.fgMinDiff;
+	return MCSS_OK;
+}
+
+int mcss_set_parameters(MCSS_Handle *handle, const MCSS_CParam *param)
+{
+	if( handle == NULL || param == NULL )
+		return MCSS_ERROR_ARGUMENT;
+	if( param->reuseInterval < 0 || param->pyramidLevels < 0 )
+	{
+		handle->error = "reuseInterval and pyramidLevels can't be negative";
+		return MCSS_ERROR_ARGUMENT;
+	}
+	/* the fields the C struct doesn't have keep their values */
+	MCSS_Param p = handle->model.getParameters();
+	p.threshold1 = param->threshold1;
+	p.threshold2 = param->threshold2;
+	p.lambda_low = param->lambda_low;
+	p.lambda_high = param->lambda_high;
+	p.tao = param->tao;
+	p.alpha = param->alpha;
+	p.mgThrFixed = Vec3f(param->mgThrFixed[0], param->mgThrFixed[1], param->mgThrFixed[2]);
+	p.isMGThrFixed = param->isMGThrFixed != 0;
+	p.hasFringe = param->hasFringe != 0;
+	p.isFixedPoint = param->isFixedPoint != 0;
+	p.isIntegerOnly = param->isIntegerOnly != 0;
+	p.reuseInterval = param->reuseInterval;
+	p.reuseMaxChange = param->reuseMaxChange;
+	p.pyramidLevels = param->pyramidLevels;
+	p.fgDeviation = param->fgDeviation;
+	p.fgMinDiff = param->fgMinDiff;
+	handle->model.setParameters(p);
+	return MCSS_OK;
+}
+
+int mcss_process(MCSS_Handle *handle, int width, int height, int format, const MCSS_CFrame *frame)
+{
+	const char *why;
+
+	if( handle == NULL )
+		return MCSS_ERROR_ARGUMENT;
+	handle->error.clear();
+	if( (why = checkFrame(width, height, format, frame)) != NULL )
+	{
+		handle->error = why;
+		return MCSS_ERROR_ARGUMENT;
+	}
+	return processFrame(handle, width, height, format, frame);
+}
+
+int mcss_process_batch(MCSS_Handle *handle, int width, int height, int format,
+		const MCSS_CFrame *frames, int count)
+{
+	const char *why;
+	int i;
+
+	if( handle == NULL )
+		return MCSS_ERROR_ARGUMENT;
+	handle->error.clear();
+	if( count < 0 || (count > 0 && frames == NULL) )
+	{
+		handle->error = "no frames";
+		return MCSS_ERROR_ARGUMENT;
+	}
+	/* every frame is checked first, so a bad one doesn't leave the model halfway through the batch */
+	for( i = 0 ; i < count ; ++i )
+	{
+		if( (why = checkFrame(width, height, format, &frames[i])) != NULL )
+		{
+			handle->error = why;
+			return MCSS_ERROR_ARGUMENT;
+		}
+	}
+	for( i = 0 ; i < count ; ++i )
+	{
+		if( processFrame(handle, width, height, format, &frames[i]) != MCSS_OK )
+			break;
+	}
+	return i;
+}
+
+const char *mcss_last_error(const MCSS_Handle *handle)
+{
+	return handle == NULL ? "NULL handle" : handle->error.c_str();
+}
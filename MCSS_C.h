@@ -0,0 +1,110 @@
+#ifndef  __MCSS_C_H__
+#define  __MCSS_C_H__
+
+/*
+ * C interface of the moving cast shadow suppression model
+ *
+ * For callers that can't use the C++ class, e.g. through the foreign
+ * function interface of another language. The frames stay in the
+ * caller's buffers: the model reads the inputs and writes the result
+ * through their pointers and row strides, nothing is copied on the way.
+ * A handle is one model, which must be used by one thread at a time.
+ * No C++ exception leaves these functions, the errors are returned.
+ *
+ * */
+
+#include  <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* bumped whenever a struct or a function below changes */
+#define  MCSS_C_API_VERSION	2
+
+/* return codes */
+#define  MCSS_OK	0
+/* a NULL pointer, a size or a stride that can't be right */
+#define  MCSS_ERROR_ARGUMENT	-1
+/* the model failed, mcss_last_error tells why */
+#define  MCSS_ERROR_MODEL	-2
+
+/* formats of the result */
+/* one byte a pixel: 0 background, 127 shadow, 255 foreground */
+#define  MCSS_RESULT_MASK	0
+/*
+ * 2-bit codes, 0 background, 1 shadow, 2 foreground, 4 pixels a byte
+ * from the low bits, (width+3)/4 bytes a row
+ * */
+#define  MCSS_RESULT_PACKED	1
+
+typedef struct MCSS_Handle MCSS_Handle;
+
+/* the parameters of MCSS_Param, the flags are 0 or 1 */
+typedef struct MCSS_CParam
+{
+	float threshold1, threshold2;
+	float lambda_low, lambda_high;
+	float tao;
+	float alpha;
+	float mgThrFixed[3];
+	int isMGThrFixed;
+	int hasFringe;
+	int isFixedPoint;
+	int isIntegerOnly;
+	int reuseInterval;
+	float reuseMaxChange;
+	int pyramidLevels;
+	float fgDeviation, fgMinDiff;
+} MCSS_CParam;
+
+/*
+ * one frame, each buffer with the bytes from a row to the next. The
+ * background and the mask are both NULL to use the built-in background
+ * model. The inputs must not change while the call runs.
+ * */
+typedef struct MCSS_CFrame
+{
+	/* 8-bit BGR */
+	const unsigned char *current;
+	size_t currentStep;
+	/* 8-bit BGR */
+	const unsigned char *background;
+	size_t backgroundStep;
+	/* 8-bit, 0 background and 255 foreground, no other values */
+	const unsigned char *mask;
+	size_t maskStep;
+	/* the result, in the format given to the call */
+	unsigned char *result;
+	size_t resultStep;
+} MCSS_CFrame;
+
+/* MCSS_C_API_VERSION of the library, to check it against the header */
+int mcss_api_version(void);
+
+/* a new model with the default parameters, NULL if it can't be made */
+MCSS_Handle *mcss_create(void);
+void mcss_destroy(MCSS_Handle *handle);
+
+int mcss_get_parameters(MCSS_Handle *handle, MCSS_CParam *param);
+int mcss_set_parameters(MCSS_Handle *handle, const MCSS_CParam *param);
+
+/* update the model with the next frame and write its result */
+int mcss_process(MCSS_Handle *handle, int width, int height, int format, const MCSS_CFrame *frame);
+/*
+ * the same for count frames in order, in one call. Return the number
+ * of frames done, less than count if frames[return value] failed
+ * (mcss_last_error tells why), or MCSS_ERROR_ARGUMENT.
+ * */
+int mcss_process_batch(MCSS_Handle *handle, int width, int height, int format,
+		const MCSS_CFrame *frames, int count);
+
+/* message of the last error of the handle, "" if none, valid until the next call */
+const char *mcss_last_error(const MCSS_Handle *handle);
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif  /*__MCSS_C_H__*/
@@ -0,0 +1,97 @@
+#ifndef  __SPSC_QUEUE_H__
+#define  __SPSC_QUEUE_H__
+
+#include  <vector>
+#include  <atomic>
+#include  <thread>
+#include  <chrono>
+
+
+/*
+ * a bounded lock-free queue between exactly one producer thread and one
+ * consumer thread. The producer only writes tail and the consumer only
+ * writes head, so a ring buffer with acquire/release ordering is enough.
+ * push and pop block while the queue is full or empty, that is the
+ * backpressure between two pipeline stages.
+ * */
+template<typename T>
+class SPSCQueue
+{
+	public:
+		explicit SPSCQueue(size_t capacity) : ring(capacity+1), head(0), tail(0)
+		{
+		}
+
+		/* producer side, return false if the queue is full */
+		bool tryPush(const T &item)
+		{
+			size_t t = tail.load(std::memory_order_relaxed);
+			size_t next = t+1 == ring.size() ? 0 : t+1;
+			if( next == head.load(std::memory_order_acquire) )
+				return false;
+			ring[t] = item;
+			tail.store(next, std::memory_order_release);
+			return true;
+		}
+
+		/* consumer side, return false if the queue is empty */
+		bool tryPop(T &item)
+		{
+			size_t h = head.load(std::memory_order_relaxed);
+			if( h == tail.load(std::memory_order_acquire) )
+				return false;
+			item = ring[h];
+			/* drop the slot's reference, so big items are freed in time */
+			ring[h] = T();
+			head.store(h+1 == ring.size() ? 0 : h+1, std::memory_order_release);
+			return true;
+		}
+
+		/* wait for a free slot, return false if stop was raised first */
+		bool push(const T &item, const std::atomic<bool> &stop)
+		{
+			int spins = 0;
+			while( !tryPush(item) )
+			{
+				if( stop )
+					return false;
+				backoff(spins);
+			}
+			return true;
+		}
+
+		/* wait for an item, return false if stop was raised first */
+		bool pop(T &item, const std::atomic<bool> &stop)
+		{
+			int spins = 0;
+			while( !tryPop(item) )
+			{
+				if( stop )
+					return false;
+				backoff(spins);
+			}
+			return true;
+		}
+
+	private:
+		std::vector<T> ring;
+		/* each index on its own cache line, so the two sides don't fight over it */
+		alignas(64) std::atomic<size_t> head;
+		alignas(64) std::atomic<size_t> tail;
+
+		/* yield for a short wait, then sleep so that an idle stage costs nothing */
+		static void backoff(int &spins)
+		{
+			if( spins++ < 64 )
+				std::this_thread::yield();
+			else
+				std::this_thread::sleep_for(std::chrono::microseconds(500));
+		}
+
+		/* not copyable */
+		SPSCQueue(const SPSCQueue &);
+		SPSCQueue &operator=(const SPSCQueue &);
+};
+
+
+#endif  /*__SPSC_QUEUE_H__*/
@@ -0,0 +1,298 @@
+/*
+ * Headless batch tool of the moving cast shadow suppression model
+ *
+ * Runs MCSS on the three inputs the app takes (videos or image sequences
+ * like "frames/%05d.png"), or on the video alone with the model's built-in
+ * background model, as fast as it can, without any window, and
+ * writes the result masks as a video, a PNG sequence or one raw file of
+ * the 8-bit (or 2-bit packed) masks one after the other. Each input is decoded by its own
+ * thread and the masks are written by another one, so the model only
+ * waits when the disk is the slowest stage. At the end it prints the
+ * frames, the throughput and where the time went.
+ *
+ * */
+
+#include  <cstdio>
+#include  <cstdlib>
+#include  <string>
+#include  <vector>
+#include  <thread>
+#include  <atomic>
+#include  "MCSS.h"
+#include  "DecodeStage.h"
+
+/* number of frames a stage may run ahead of the next one */
+#define  BATCH_QUEUE_DEPTH	8
+/* frame rate of the output video when the input doesn't tell */
+#define  DEFAULT_FPS	25
+
+enum OutputKind
+{
+	OUTPUT_VIDEO,
+	OUTPUT_PNG,
+	OUTPUT_RAW,
+	/* raw, with the 2-bit codes of MCSS::getPackedResult */
+	OUTPUT_PACKED
+};
+
+/* where the masks go */
+class MaskWriter
+{
+	public:
+		MaskWriter(OutputKind kind, const string &path, double fps, const string &fourcc);
+		~MaskWriter();
+		/* write the next mask, return false on an error */
+		bool write(const Mat &mask);
+
+		/* frames written and the time (s) spent writing them */
+		int frames;
+		double time;
+
+	private:
+		OutputKind kind;
+		string path;
+		double fps;
+		string fourcc;
+		VideoWriter video;
+		FILE *raw;
+};
+
+MaskWriter::MaskWriter(OutputKind _kind, const string &_path, double _fps, const string &_fourcc)
+	: frames(0), time(0), kind(_kind), path(_path), fps(_fps), fourcc(_fourcc), raw(NULL)
+{
+}
+
+MaskWriter::~MaskWriter()
+{
+	if( raw != NULL )
+		fclose(raw);
+}
+
+bool MaskWriter::write(const Mat &mask)
+{
+	int64 t0 = getTickCount();
+	bool ok = true;
+	int i;
+
+	switch( kind )
+	{
+		case OUTPUT_VIDEO:
+			/* opened on the first mask, which gives the size */
+			if( !video.isOpened() && !video.open(path, CV_FOURCC(fourcc[0], fourcc[1], fourcc[2], fourcc[3]),
+						fps, mask.size(), false) )
+				return false;
+			video << mask;
+			break;
+		case OUTPUT_PNG:
+		{
+			/* path is a printf pattern of the frame number */
+			vector<char> name(path.size()+32);
+			snprintf(&name[0], name.size(), path.c_str(), frames);
+			ok = imwrite(&name[0], mask);
+			break;
+		}
+		case OUTPUT_RAW:
+		case OUTPUT_PACKED:
+			if( raw == NULL && (raw = fopen(path.c_str(), "wb")) == NULL )
+				return false;
+			for( i = 0 ; i < mask.rows && ok ; ++i )
+				ok = fwrite(mask.ptr<uchar>(i), 1, mask.cols, raw) == (size_t)mask.cols;
+			break;
+	}
+	time += (getTickCount()-t0)/getTickFrequency();
+	++frames;
+	return ok;
+}
+
+/**
+ * @brief writeLoop: output stage, writes the masks until the empty one
+ *
+ * @param writer: where the masks go
+ * @param queue: queue from the processing stage
+ * @param failed: raised if a mask can't be written
+ * @param stop: raised when the pipeline shuts down
+ */
+static void writeLoop(MaskWriter *writer, FrameQueue *queue, std::atomic<bool> *failed,
+		std::atomic<bool> *stop)
+{
+	Mat mask;
+
+	while( queue->pop(mask, *stop) && mask.data )
+	{
+		if( !writer->write(mask) )
+		{
+			*failed = true;
+			*stop = true;
+			return;
+		}
+	}
+}
+
+static void usage(const char *name)
+{
+	cerr << "Usage: " << name << " [options] <video> [<mask> <bg>] <output>" << endl
+		<< "  the inputs are videos or image sequences (\"frames/%05d.png\")," << endl
+		<< "  without the mask and the background the model makes its own" << endl
+		<< "  --format video|png|raw|packed  a video, a PNG sequence (output is a pattern like \"out/%06d.png\")," << endl
+		<< "                           the 8-bit masks one after the other in one file or the same with" << endl
+		<< "                           2-bit codes, 4 pixels a byte, 0 background, 1 shadow, 2 object (video)" << endl
+		<< "  --fourcc XXXX            codec of the output video (FFV1)" << endl
+		<< "  --fps F                  frame rate of the output video (the input's, else " << DEFAULT_FPS << ")" << endl
+		<< "  --frames N               stop after N frames" << endl
+		<< "  --background-frames N    only read the first N background frames, then keep the last one" << endl
+		<< "  --fixed-point            compute the luminance ratio in fixed point" << endl
+		<< "  --integer                run on integers only (implies --fixed-point)" << endl
+		<< "  --reuse K                let slowly moving objects keep their LGCs for up to K frames" << endl
+		<< "  --pyramid L              run on the frames halved L times and refine the result" << endl;
+}
+
+int main(int argc, char *argv[])
+{
+	VideoCapture cap, cap2, cap3;
+	MCSS fgr;
+	MCSS_Param p = fgr.getParameters();
+	OutputKind kind = OUTPUT_VIDEO;
+	string fourcc = "FFV1";
+	double fps = 0, modelTime = 0, waitTime = 0;
+	int maxFrames = 0, bgFrames = 0, frames = 0, i, inputs;
+	bool ok = true, hasBackground = true, hasMask;
+
+	for( i = 1 ; i < argc && ok && string(argv[i]).compare(0, 2, "--") == 0 ; ++i )
+	{
+		string arg = argv[i];
+		bool hasValue = i+1 < argc;
+		if( arg == "--format" && hasValue )
+		{
+			arg = argv[++i];
+			kind = arg == "png" ? OUTPUT_PNG : arg == "raw" ? OUTPUT_RAW : arg == "packed" ? OUTPUT_PACKED : OUTPUT_VIDEO;
+			ok = kind != OUTPUT_VIDEO || arg == "video";
+		}
+		else if( arg == "--fourcc" && hasValue )
+			ok = (fourcc = argv[++i]).size() == 4;
+		else if( arg == "--fps" && hasValue )
+			ok = (fps = atof(argv[++i])) > 0;
+		else if( arg == "--frames" && hasValue )
+			ok = (maxFrames = atoi(argv[++i])) > 0;
+		else if( arg == "--background-frames" && hasValue )
+			ok = (bgFrames = atoi(argv[++i])) > 0;
+		else if( arg == "--fixed-point" )
+			p.isFixedPoint = true;
+		else if( arg == "--integer" )
+			p.isIntegerOnly = true;
+		else if( arg == "--reuse" && hasValue )
+			ok = (p.reuseInterval = atoi(argv[++i])) >= 0;
+		else if( arg == "--pyramid" && hasValue )
+			ok = (p.pyramidLevels = atoi(argv[++i])) >= 0;
+		else
+			ok = false;
+	}
+	/* the inputs, then the output */
+	inputs = argc-i-1;
+	if( !ok || (inputs != 1 && inputs != 3) )
+	{
+		usage(argv[0]);
+		return -1;
+	}
+	fgr.setParameters(p);
+
+	hasMask = inputs == 3;
+	if( !cap.open(string(argv[i])) || (hasMask && (!cap2.open(string(argv[i+1])) || !cap3.open(string(argv[i+2])))) )
+	{
+		cerr << "Can not open the inputs" << endl;
+		return -1;
+	}
+	if( fps <= 0 )
+		fps = cap.get(CV_CAP_PROP_FPS);
+	if( fps <= 0 )
+		fps = DEFAULT_FPS;
+
+	/*
+	 * decode -> process -> write pipeline, each input is decoded by its
+	 * own thread, the model runs on this one and the masks are written by
+	 * another one. The bounded queues hold back a stage that runs ahead.
+	 * */
+	MaskWriter writer(kind, argv[argc-1], fps, fourcc);
+	std::atomic<bool> stop(false), failed(false);
+	FrameQueue videoQueue(BATCH_QUEUE_DEPTH), maskQueue(BATCH_QUEUE_DEPTH), bgQueue(BATCH_QUEUE_DEPTH);
+	FrameQueue outQueue(BATCH_QUEUE_DEPTH);
+	std::thread videoThread(decodeLoop, &cap, INPUT_VIDEO, maxFrames, &videoQueue, &stop);
+	std::thread maskThread, bgThread;
+	if( hasMask )
+	{
+		maskThread = std::thread(decodeLoop, &cap2, INPUT_MASK, maxFrames, &maskQueue, &stop);
+		bgThread = std::thread(decodeLoop, &cap3, INPUT_BACKGROUND, bgFrames, &bgQueue, &stop);
+	}
+	std::thread writeThread(writeLoop, &writer, &outQueue, &failed, &stop);
+
+	int64 start = getTickCount();
+	Mat bg;
+	while( 1 )
+	{
+		Mat frame, mask, tmp, dst;
+		if( !videoQueue.pop(frame, stop) || !frame.data )
+			break;
+		if( !hasMask )
+		{
+			int64 t0 = getTickCount();
+			fgr(frame);
+			modelTime += (getTickCount()-t0)/getTickFrequency();
+		}
+		else
+		{
+			if( !maskQueue.pop(mask, stop) || !mask.data )
+				break;
+			if( hasBackground )
+			{
+				if( !bgQueue.pop(tmp, stop) )
+					break;
+				/* keep the last background once its input is over */
+				if( tmp.data )
+					bg = tmp;
+				else
+					hasBackground = false;
+			}
+			if( !bg.data )
+				break;
+			int64 t0 = getTickCount();
+			fgr(frame, bg, mask);
+			modelTime += (getTickCount()-t0)/getTickFrequency();
+		}
+		/* straight into the matrix that goes to the writer, no copy of the whole mask */
+		if( kind == OUTPUT_PACKED )
+		{
+			dst.create(frame.rows, (frame.cols+3)/4, CV_8UC1);
+			fgr.getPackedResult(dst.data, dst.step);
+		}
+		else
+		{
+			dst.create(frame.size(), CV_8UC1);
+			fgr.getResult(dst.data, dst.step);
+		}
+
+		int64 t1 = getTickCount();
+		if( !outQueue.push(dst, stop) )
+			break;
+		waitTime += (getTickCount()-t1)/getTickFrequency();
+		++frames;
+	}
+	outQueue.push(Mat(), stop);
+	writeThread.join();
+	double total = (getTickCount()-start)/getTickFrequency();
+	stop = true;
+	videoThread.join();
+	if( hasMask )
+	{
+		maskThread.join();
+		bgThread.join();
+	}
+
+	if( failed )
+		cerr << "Can not write " << argv[argc-1] << endl;
+	fprintf(stderr, "%d frames (%d written) in %.2f s: %.2f fps\n"
+			"model %.2f s (%.3f ms/frame, %.2f fps alone), waiting for the writer %.2f s, writing %.2f s\n",
+			frames, writer.frames, total, total > 0 ? frames/total : 0,
+			modelTime, frames ? modelTime*1000/frames : 0, modelTime > 0 ? frames/modelTime : 0,
+			waitTime, writer.time);
+
+	return failed ? 1 : 0;
+}
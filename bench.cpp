@@ -0,0 +1,1343 @@
+/*
+ * Headless benchmark of the moving cast shadow suppression model
+ *
+ * Runs MCSS::operator() on synthetic scenes (or on the three videos the
+ * app takes) at several resolutions, object counts and foreground
+ * densities, in both isMGThrFixed and both hasFringe modes, and prints
+ * the fps, the mean/p50/p99 latency, the mean time of each stage and
+ * the peak RSS of each run as JSON or CSV. With --check N it also runs N models on their own threads and
+ * checks that they give the same masks as a single model, then feeds N
+ * streams, each its own scene, through one MCSSEngine and checks that
+ * every stream gets its masks back in order and equal to those of a
+ * model of its own. --output times
+ * reading the result as 2-bit codes or runs instead of the 8-bit mask.
+ * With --integer a float model runs next to the integer only one, untimed,
+ * and the part of the pixels they classify differently is reported.
+ * With glibc the heap allocations of each timed frame are counted.
+ * --zero-alloc runs a model a few times over the same frames and checks
+ * that the last pass allocates nothing: the buffers and tables the first
+ * ones made are enough. Without --pyramid it checks pyramid mode too.
+ *
+ * --verify checks the masks instead of timing the model. It runs a fixed
+ * set of synthetic scenes, which know which pixels are shadow and which
+ * are objects, through the model and through the frozen copy of the
+ * model from before the performance work (MCSSReference.cpp) side by
+ * side. It compares their masks pixel by pixel and reports, for both, the
+ * part of the shadow pixels found as shadow and of the object pixels
+ * found as foreground. The modes without an allowed difference (see
+ * allowedDifferences) must match the reference up to --tolerance, the
+ * others must not lose more than VERIFY_ACCURACY_LOSS of its accuracy,
+ * and pyramid mode no more than VERIFY_PYRAMID_*_LOSS more per level.
+ *
+ * */
+
+#include  <cstdio>
+#include  <cstdlib>
+#include  <cstring>
+#include  <cmath>
+#include  <vector>
+#include  <string>
+#include  <algorithm>
+#include  <thread>
+#include  <atomic>
+#include  <functional>
+#include  <cerrno>
+#include  <sys/resource.h>
+#include  "MCSS.h"
+#include  "MCSSKernels.h"
+#include  "MCSSEngine.h"
+#include  "MCSSReference.h"
+
+/* timed frames and untimed warm up frames of each run */
+#define  BENCH_FRAMES	100
+#define  BENCH_WARMUP	10
+/* frames of the concurrent and the allocation checks */
+#define  CHECK_FRAMES	30
+/* passes of the allocation check over its frames */
+#define  CHECK_PASSES	4
+/* noisy copies of the background the synthetic frames cycle through */
+#define  NOISE_VARIANTS	4
+/* largest speed of the synthetic objects, pixels per frame */
+#define  OBJECT_SPEED	4
+/* one salt noise pixel in the mask per this many pixels */
+#define  SALT_NOISE	4000
+/* frames of each verification scene */
+#define  VERIFY_FRAMES	40
+/* detection or discrimination rate a mode with an allowed difference may lose against the reference */
+#define  VERIFY_ACCURACY_LOSS	0.03
+/*
+ * detection and discrimination rate pyramid mode may lose on top of it
+ * per level. Averaging the frames blurs the small shadows into their
+ * background: the busy scene finds 0.078 less of its shadow at 1 level
+ * with the adaptive threshold, the 320x240 one 0.185 less at 2 levels
+ * with the fixed one, while the refinement of the boundaries keeps the
+ * object pixels within 0.044.
+ * */
+#define  VERIFY_PYRAMID_DETECTION_LOSS	0.1
+/*
+ * and integer only pyramid mode on top of that: its coarse level with the
+ * adaptive threshold finds up to 0.072 less shadow than the float one.
+ * */
+#define  VERIFY_INTEGER_PYRAMID_LOSS	0.08
+#define  VERIFY_PYRAMID_DISCRIMINATION_LOSS	0.025
+
+#ifdef __GLIBC__
+/* 
+ * heap allocations of the process, counted by putting these in front of
+ * the allocator of glibc. Every malloc of the program, of OpenCV and of
+ * operator new goes through them.
+ * */
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t n, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+void *__libc_memalign(size_t alignment, size_t size);
+}
+
+static std::atomic<long long> allocations(0);
+
+extern "C" void *malloc(size_t size)
+{
+	++allocations;
+	return __libc_malloc(size);
+}
+
+extern "C" void *calloc(size_t n, size_t size)
+{
+	++allocations;
+	return __libc_calloc(n, size);
+}
+
+extern "C" void *realloc(void *ptr, size_t size)
+{
+	++allocations;
+	return __libc_realloc(ptr, size);
+}
+
+extern "C" void *memalign(size_t alignment, size_t size)
+{
+	++allocations;
+	return __libc_memalign(alignment, size);
+}
+
+extern "C" void *aligned_alloc(size_t alignment, size_t size)
+{
+	++allocations;
+	return __libc_memalign(alignment, size);
+}
+
+extern "C" int posix_memalign(void **ptr, size_t alignment, size_t size)
+{
+	++allocations;
+	*ptr = __libc_memalign(alignment, size);
+	return *ptr != NULL ? 0 : ENOMEM;
+}
+
+static inline long long allocationCount()
+{
+	return allocations;
+}
+#else
+/* not counted */
+static inline long long allocationCount()
+{
+	return -1;
+}
+#endif
+
+/* names of the MCSS_Stage values in the output */
+static const char *stageNames[STAGE_NUM] = {"objects", "background", "lumratio", "lgc", "lgc_stats", "classify", "pyramid"};
+
+/* frames of one run */
+class FrameSource
+{
+	public:
+		virtual ~FrameSource() {}
+		/* get the next frame, return false at the end of the input */
+		virtual bool next(Mat &current, Mat &background, Mat &mask) = 0;
+};
+
+/*
+ * moving textured ellipses, each casting a darker copy of the background
+ * next to it. The mask is objects + shadows + salt noise, density is the
+ * part of the frame they cover. The same arguments give the same frames.
+ * */
+class SyntheticSource : public FrameSource
+{
+	public:
+		/* speed 0 keeps the objects still, so that --reuse finds them again */
+		SyntheticSource(Size size, int objects, float density, unsigned seed = 1, float speed = OBJECT_SPEED);
+		bool next(Mat &current, Mat &background, Mat &mask);
+		/* exact classes of the last frame: 0 background, 127 shadow, 255 object */
+		const Mat &getTruth() const { return truth; }
+
+	private:
+		struct Object
+		{
+			float x, y, vx, vy;
+			Vec3b color;
+			/* luminance attenuation of its shadow */
+			float att;
+		};
+
+		Size size;
+		RNG rng;
+		Mat bg, truth;
+		vector<Mat> noisy;
+		vector<Object> objs;
+		/* radii of the objects */
+		float rx, ry;
+		int t;
+
+		void drawShadow(const Object &o, Mat &current, Mat &mask);
+		void drawObject(const Object &o, Mat &current, Mat &mask);
+};
+
+SyntheticSource::SyntheticSource(Size size, int objects, float density, unsigned seed, float speed)
+	: size(size), rng(seed), t(0)
+{
+	int i, j, k, c;
+
+	bg.create(size, CV_8UC3);
+	for( i = 0 ; i < size.height ; ++i )
+	{
+		Vec3b *p = bg.ptr<Vec3b>(i);
+		for( j = 0 ; j < size.width ; ++j )
+			p[j] = Vec3b(60+100*j/size.width+rng.uniform(0, 20),
+					80+80*i/size.height+rng.uniform(0, 20), 120+rng.uniform(0, 40));
+	}
+	/* sensor noise, so that the background model has some deviation */
+	noisy.resize(NOISE_VARIANTS);
+	for( k = 0 ; k < NOISE_VARIANTS ; ++k )
+	{
+		noisy[k].create(size, CV_8UC3);
+		for( i = 0 ; i < size.height ; ++i )
+		{
+			const uchar *s = bg.ptr<uchar>(i);
+			uchar *d = noisy[k].ptr<uchar>(i);
+			for( j = 0 ; j < size.width*3 ; ++j )
+			{
+				c = s[j]+rng.uniform(-3, 4);
+				d[j] = (uchar)std::min(std::max(c, 0), 255);
+			}
+		}
+	}
+
+	/* the object takes 60% of its share of the foreground, the shadow the rest */
+	objects = std::max(objects, 1);
+	ry = std::sqrt(0.6f*density*size.area()/objects/(float)CV_PI/1.3f);
+	ry = std::max(ry, 2.0f);
+	rx = 1.3f*ry;
+	objs.resize(objects);
+	for( k = 0 ; k < objects ; ++k )
+	{
+		Object &o = objs[k];
+		o.x = rng.uniform(0.f, (float)size.width);
+		o.y = rng.uniform(0.f, (float)size.height);
+		o.vx = rng.uniform(-4.f, 4.f)*speed/OBJECT_SPEED;
+		o.vy = rng.uniform(-4.f, 4.f)*speed/OBJECT_SPEED;
+		o.color = Vec3b(rng.uniform(0, 256), rng.uniform(0, 256), rng.uniform(0, 256));
+		o.att = rng.uniform(0.45f, 0.75f);
+	}
+}
+
+void SyntheticSource::drawShadow(const Object &o, Mat &current, Mat &mask)
+{
+	float cx = o.x+0.5f*rx, cy = o.y+0.8f*ry, ax = 1.2f*rx, ay = 0.5f*ry;
+	int i, j, k;
+	int i0 = std::max(0, (int)(cy-ay)), i1 = std::min(size.height-1, (int)(cy+ay));
+	int j0 = std::max(0, (int)(cx-ax)), j1 = std::min(size.width-1, (int)(cx+ax));
+
+	for( i = i0 ; i <= i1 ; ++i )
+	{
+		const Vec3b *b = bg.ptr<Vec3b>(i);
+		Vec3b *c = current.ptr<Vec3b>(i);
+		uchar *m = mask.ptr<uchar>(i), *t = truth.ptr<uchar>(i);
+		for( j = j0 ; j <= j1 ; ++j )
+		{
+			float dx = (j-cx)/ax, dy = (i-cy)/ay;
+			if( dx*dx+dy*dy > 1 )
+				continue;
+			for( k = 0 ; k < 3 ; ++k )
+				c[j][k] = (uchar)(b[j][k]*o.att);
+			m[j] = 255;
+			t[j] = 127;
+		}
+	}
+}
+
+void SyntheticSource::drawObject(const Object &o, Mat &current, Mat &mask)
+{
+	int i, j, k;
+	int i0 = std::max(0, (int)(o.y-ry)), i1 = std::min(size.height-1, (int)(o.y+ry));
+	int j0 = std::max(0, (int)(o.x-rx)), j1 = std::min(size.width-1, (int)(o.x+rx));
+
+	for( i = i0 ; i <= i1 ; ++i )
+	{
+		Vec3b *c = current.ptr<Vec3b>(i);
+		uchar *m = mask.ptr<uchar>(i), *t = truth.ptr<uchar>(i);
+		for( j = j0 ; j <= j1 ; ++j )
+		{
+			float dx = (j-o.x)/rx, dy = (i-o.y)/ry;
+			if( dx*dx+dy*dy > 1 )
+				continue;
+			/* some texture, a flat object would be one big LGC */
+			for( k = 0 ; k < 3 ; ++k )
+				c[j][k] = saturate_cast<uchar>(o.color[k]+((i+j+k)&7)*6-21);
+			m[j] = 255;
+			t[j] = 255;
+		}
+	}
+}
+
+bool SyntheticSource::next(Mat &current, Mat &background, Mat &mask)
+{
+	int k, n;
+
+	noisy[t%NOISE_VARIANTS].copyTo(current);
+	background = bg;
+	mask.create(size, CV_8UC1);
+	mask.setTo(Scalar(0));
+	truth.create(size, CV_8UC1);
+	truth.setTo(Scalar(0));
+	for( k = 0 ; k < (int)objs.size() ; ++k )
+	{
+		Object &o = objs[k];
+		o.x += o.vx;
+		o.y += o.vy;
+		if( o.x < 0 || o.x >= size.width )
+			o.vx = -o.vx;
+		if( o.y < 0 || o.y >= size.height )
+			o.vy = -o.vy;
+		drawShadow(o, current, mask);
+	}
+	/* the objects are drawn over all the shadows, the salt noise is no class of its own */
+	for( k = 0 ; k < (int)objs.size() ; ++k )
+		drawObject(objs[k], current, mask);
+	for( n = size.area()/SALT_NOISE ; n > 0 ; --n )
+		mask.at<uchar>(rng.uniform(0, size.height), rng.uniform(0, size.width)) = 255;
+	++t;
+	return true;
+}
+
+/* the video, mask and background files the app takes */
+class VideoSource : public FrameSource
+{
+	public:
+		VideoSource(const string &video, const string &mask, const string &background);
+		bool isOpened() { return cap.isOpened() && cap2.isOpened() && cap3.isOpened(); }
+		bool next(Mat &current, Mat &background, Mat &mask);
+
+	private:
+		VideoCapture cap, cap2, cap3;
+		/* the last background, kept once the background video is over */
+		Mat bg;
+};
+
+VideoSource::VideoSource(const string &video, const string &mask, const string &background)
+	: cap(video), cap2(mask), cap3(background)
+{
+}
+
+bool VideoSource::next(Mat &current, Mat &background, Mat &mask)
+{
+	Mat tmp;
+
+	cap >> current;
+	cap2 >> tmp;
+	if( !current.data || !tmp.data )
+		return false;
+	cvtColor(tmp, mask, CV_BGR2GRAY);
+	threshold(mask, mask, 128, 255, CV_THRESH_BINARY);
+	cap3 >> tmp;
+	if( tmp.data )
+		tmp.copyTo(bg);
+	if( !bg.data )
+		return false;
+	background = bg;
+	return true;
+}
+
+/* how the benchmark reads the result of each frame */
+enum ResultEncoding
+{
+	ENCODING_DENSE,
+	ENCODING_PACKED,
+	ENCODING_RUNS
+};
+
+static const char *encodingNames[] = {"dense", "packed", "runs"};
+
+struct RunResult
+{
+	string source;
+	Size size;
+	int objects;
+	float density;
+	MCSS_Param param;
+	/* the model made its own background and mask */
+	bool builtin;
+	ResultEncoding encoding;
+	int frames;
+	/* frames per second and latency (ms) of the model alone */
+	double fps, mean, p50, p99;
+	/* 
+	 * mean time (ms) of each stage, mean number of objects found, of LGC
+	 * regions and of objects that kept theirs
+	 * */
+	double stageTime[STAGE_NUM], objectsFound, lgcs, reusedObjects;
+	/* largest equivalence table of the labelers */
+	int peakLabels;
+	/* mean size (bytes) of the result in its encoding */
+	double resultBytes;
+	/* part of the pixels the float model classifies differently, < 0 if not compared */
+	double floatMismatch;
+	/* 
+	 * heap allocations of a timed frame (the model and the reading of the
+	 * result), mean and most in one frame, < 0 if they can't be counted
+	 * */
+	double allocations;
+	long long peakAllocations;
+	/* peak resident set size (kB) */
+	long peakRSS;
+};
+
+/* the heap allocations of a model on frames it has already seen once */
+struct AllocCheck
+{
+	Size size;
+	int objects;
+	float density, speed;
+	MCSS_Param param;
+	bool builtin;
+	int frames;
+	/* allocations of the last pass over the frames, < 0 if they can't be counted */
+	long long allocations;
+	/* objects that kept their lgcs in the last pass */
+	int reusedObjects;
+};
+
+struct CheckResult
+{
+	/* the instances are the streams of one MCSSEngine, not threads of their own */
+	bool engine;
+	int instances;
+	Size size;
+	MCSS_Param param;
+	int frames;
+	/* frames per second of all the instances together */
+	double fps;
+	bool ok;
+};
+
+/**
+ * @brief resetPeakRSS: restart the peak RSS count of the process
+ *
+ * @return: false if the kernel can't, then the peak is the one of the whole process
+ */
+static bool resetPeakRSS()
+{
+	FILE *f = fopen("/proc/self/clear_refs", "w");
+	bool ok;
+
+	if( f == NULL )
+		return false;
+	ok = fputs("5", f) >= 0;
+	return fclose(f) == 0 && ok;
+}
+
+/**
+ * @brief peakRSS: peak resident set size in kB, since the last resetPeakRSS
+ */
+static long peakRSS()
+{
+	FILE *f = fopen("/proc/self/status", "r");
+	char line[256];
+	long kb = -1;
+	struct rusage ru;
+
+	if( f != NULL )
+	{
+		while( fgets(line, sizeof(line), f) != NULL )
+			if( sscanf(line, "VmHWM: %ld kB", &kb) == 1 )
+				break;
+		fclose(f);
+	}
+	if( kb < 0 && getrusage(RUSAGE_SELF, &ru) == 0 )
+		kb = ru.ru_maxrss;
+	return kb;
+}
+
+static MCSS_Param makeParam(bool mgThrFixed, bool fringe, bool fixedPoint, bool integerOnly, int reuseInterval,
+		int pyramidLevels)
+{
+	MCSS fgr;
+	MCSS_Param p = fgr.getParameters();
+
+	p.isMGThrFixed = mgThrFixed;
+	p.hasFringe = fringe;
+	p.isFixedPoint = fixedPoint || integerOnly;
+	p.isIntegerOnly = integerOnly;
+	p.reuseInterval = reuseInterval;
+	p.pyramidLevels = pyramidLevels;
+	return p;
+}
+
+/* number of pixels two 8-bit masks of the same size differ on */
+static int countDifferent(const Mat &a, const Mat &b)
+{
+	int i, j, n = 0;
+
+	for( i = 0 ; i < a.rows ; ++i )
+	{
+		const uchar *pa = a.ptr<uchar>(i), *pb = b.ptr<uchar>(i);
+		for( j = 0 ; j < a.cols ; ++j )
+			n += pa[j] != pb[j];
+	}
+	return n;
+}
+
+/**
+ * @brief runBench: time a new model on the frames of src
+ *
+ * @param src: the frames
+ * @param p: parameters of the model
+ * @param builtin: give the model the frame alone, it runs its built-in background model
+ * @param encoding: how the result is read, it is part of the timed frame
+ * @param warmup: frames run before the timing starts
+ * @param frames: timed frames, less if src ends before
+ * @param res: the size, fps, latency, stage times and peak RSS are written here,
+ *			   and the mismatch against a float model in the integer only mode
+ */
+static void runBench(FrameSource &src, const MCSS_Param &p, bool builtin, ResultEncoding encoding,
+		int warmup, int frames, RunResult &res)
+{
+	MCSS fgr, reference;
+	MCSS_Param q = p;
+	Mat current, background, mask, output, dense, expected;
+	vector<MCSS_Run> runs;
+	vector<int> rowStart;
+	vector<double> latency;
+	double sum = 0, mismatch = 0;
+	long long allocs, totalAllocs = 0;
+	int n, k;
+
+	res.objectsFound = 0;
+	res.lgcs = 0;
+	res.reusedObjects = 0;
+	res.resultBytes = 0;
+	res.peakLabels = 0;
+	res.peakAllocations = 0;
+	for( k = 0 ; k < STAGE_NUM ; ++k )
+		res.stageTime[k] = 0;
+	latency.reserve(frames);
+	fgr.setParameters(p);
+	q.isFixedPoint = q.isIntegerOnly = false;
+	reference.setParameters(q);
+	resetPeakRSS();
+	for( n = 0 ; n < warmup+frames ; ++n )
+	{
+		if( !src.next(current, background, mask) )
+			break;
+		/* the buffer is the caller's, made once like a real caller would */
+		int width = encoding == ENCODING_PACKED ? (current.cols+3)/4 : current.cols;
+		output.create(current.rows, width, CV_8UC1);
+		allocs = allocationCount();
+		int64 t0 = getTickCount();
+		if( builtin )
+			fgr(current);
+		else
+			fgr(current, background, mask);
+		if( encoding == ENCODING_PACKED )
+			fgr.getPackedResult(output.data, output.step);
+		else if( encoding == ENCODING_RUNS )
+			fgr.getResultRuns(runs, rowStart);
+		else
+			fgr.getResult(output.data, output.step);
+		double ms = (getTickCount()-t0)*1000.0/getTickFrequency();
+		allocs = allocationCount()-allocs;
+		if( p.isIntegerOnly )
+		{
+			/* the float model sees the same frames, outside the timing */
+			if( builtin )
+				reference(current);
+			else
+				reference(current, background, mask);
+			dense.create(current.size(), CV_8UC1);
+			expected.create(current.size(), CV_8UC1);
+			fgr.getResult(dense.data, dense.step);
+			reference.getResult(expected.data, expected.step);
+		}
+		if( n >= warmup )
+		{
+			if( p.isIntegerOnly )
+				mismatch += (double)countDifferent(dense, expected)/dense.total();
+			const MCSS_Stats &stats = fgr.getStats();
+			latency.push_back(ms);
+			sum += ms;
+			for( k = 0 ; k < STAGE_NUM ; ++k )
+				res.stageTime[k] += stats.stageTime[k];
+			res.objectsFound += stats.objects;
+			res.lgcs += stats.lgcs;
+			res.reusedObjects += stats.reusedObjects;
+			res.resultBytes += encoding == ENCODING_RUNS ? runs.size()*sizeof(MCSS_Run)+rowStart.size()*sizeof(int)
+				: output.total();
+			res.peakLabels = std::max(res.peakLabels, stats.peakLabels);
+			totalAllocs += allocs;
+			res.peakAllocations = std::max(res.peakAllocations, allocs);
+		}
+	}
+	res.peakRSS = peakRSS();
+	res.size = current.size();
+	res.param = p;
+	res.builtin = builtin;
+	res.encoding = encoding;
+	res.frames = latency.size();
+	res.floatMismatch = p.isIntegerOnly && !latency.empty() ? mismatch/latency.size() : -1;
+	res.allocations = allocationCount() >= 0 && !latency.empty() ? (double)totalAllocs/latency.size() : -1;
+	if( res.allocations < 0 )
+		res.peakAllocations = -1;
+	res.fps = res.mean = res.p50 = res.p99 = 0;
+	if( latency.empty() )
+		return;
+	for( k = 0 ; k < STAGE_NUM ; ++k )
+		res.stageTime[k] /= latency.size();
+	res.objectsFound /= latency.size();
+	res.resultBytes /= latency.size();
+	res.lgcs /= latency.size();
+	res.reusedObjects /= latency.size();
+	std::sort(latency.begin(), latency.end());
+	res.fps = latency.size()*1000.0/sum;
+	res.mean = sum/latency.size();
+	res.p50 = latency[latency.size()/2];
+	res.p99 = latency[std::min(latency.size()-1, latency.size()*99/100)];
+}
+
+/* run a new model on all the frames and keep its masks */
+static void runFrames(MCSS_Param p, const vector<Mat> &current, const vector<Mat> &background,
+		const vector<Mat> &mask, vector<Mat> &output)
+{
+	MCSS fgr;
+	size_t n;
+
+	fgr.setParameters(p);
+	output.resize(current.size());
+	for( n = 0 ; n < current.size() ; ++n )
+		fgr(current[n], background[n], mask[n], output[n]);
+}
+
+static bool sameMat(const Mat &a, const Mat &b)
+{
+	int i;
+
+	if( a.size() != b.size() || a.type() != b.type() )
+		return false;
+	for( i = 0 ; i < a.rows ; ++i )
+		if( memcmp(a.ptr(i), b.ptr(i), a.cols*a.elemSize()) != 0 )
+			return false;
+	return true;
+}
+
+/**
+ * @brief checkConcurrent: run one model, then the given number of models
+ *						   on their own threads, on the same frames
+ *
+ * @param res: instances, size, param and frames in, fps and ok out
+ * @param objects: object count of the synthetic scene
+ * @param density: foreground density of the synthetic scene
+ */
+static void checkConcurrent(CheckResult &res, int objects, float density)
+{
+	SyntheticSource src(res.size, objects, density);
+	vector<Mat> current, background, mask, expected;
+	vector< vector<Mat> > output(res.instances);
+	vector<std::thread> threads;
+	int n, k;
+
+	for( n = 0 ; n < res.frames ; ++n )
+	{
+		Mat c, b, m;
+		src.next(c, b, m);
+		current.push_back(c.clone());
+		background.push_back(b);
+		mask.push_back(m.clone());
+	}
+	runFrames(res.param, current, background, mask, expected);
+
+	int64 t0 = getTickCount();
+	for( k = 0 ; k < res.instances ; ++k )
+		threads.push_back(std::thread(runFrames, res.param, std::cref(current),
+					std::cref(background), std::cref(mask), std::ref(output[k])));
+	for( k = 0 ; k < res.instances ; ++k )
+		threads[k].join();
+	res.fps = res.instances*res.frames*getTickFrequency()/(getTickCount()-t0);
+
+	res.ok = true;
+	for( k = 0 ; k < res.instances ; ++k )
+		for( n = 0 ; n < res.frames ; ++n )
+			res.ok = res.ok && sameMat(expected[n], output[k][n]);
+}
+
+/**
+ * @brief checkEngine: run the given number of streams, each its own scene,
+ *					   through one MCSSEngine, and each scene through a
+ *					   model of its own
+ *
+ * The frames of all the streams are submitted interleaved, and a stream
+ * is fetched whenever its queue is full, so the workers always have the
+ * frames of several streams to pick from.
+ *
+ * @param res: instances, size, param and frames in, fps and ok out
+ * @param objects: object count of the synthetic scenes
+ * @param density: foreground density of the synthetic scenes
+ */
+static void checkEngine(CheckResult &res, int objects, float density)
+{
+	vector< vector<Mat> > current(res.instances), background(res.instances), mask(res.instances);
+	vector< vector<Mat> > expected(res.instances), output(res.instances);
+	MCSSEngine engine;
+	MCSS_FetchResult fetched;
+	Mat out;
+	int n, k;
+
+	for( k = 0 ; k < res.instances ; ++k )
+	{
+		SyntheticSource src(res.size, objects, density, k+1);
+		for( n = 0 ; n < res.frames ; ++n )
+		{
+			Mat c, b, m;
+			src.next(c, b, m);
+			current[k].push_back(c.clone());
+			background[k].push_back(b);
+			mask[k].push_back(m.clone());
+		}
+		runFrames(res.param, current[k], background[k], mask[k], expected[k]);
+		engine.addStream(res.param);
+	}
+
+	res.ok = true;
+	int64 t0 = getTickCount();
+	for( n = 0 ; n < res.frames ; ++n )
+		for( k = 0 ; k < res.instances ; ++k )
+		{
+			engine.submit(k, current[k][n], background[k][n], mask[k][n]);
+			if( n+1 < DEFAULT_STREAM_QUEUE_SIZE )
+				continue;
+			fetched = engine.fetch(k, out);
+			res.ok = res.ok && fetched == MCSS_FETCH_OK;
+			output[k].push_back(out);
+		}
+	for( k = 0 ; k < res.instances ; ++k )
+		while( (fetched = engine.fetch(k, out)) )
+		{
+			res.ok = res.ok && fetched == MCSS_FETCH_OK;
+			output[k].push_back(out);
+		}
+	res.fps = res.instances*res.frames*getTickFrequency()/(getTickCount()-t0);
+
+	/* the n-th result of a stream must be its n-th frame */
+	for( k = 0 ; k < res.instances ; ++k )
+	{
+		res.ok = res.ok && (int)output[k].size() == res.frames;
+		for( n = 0 ; res.ok && n < res.frames ; ++n )
+			res.ok = sameMat(expected[k][n], output[k][n]);
+	}
+}
+
+/**
+ * @brief checkAllocations: run a model CHECK_PASSES times over the same synthetic
+ *						    frames and count the heap allocations of the last pass
+ *
+ * The first passes make the model's buffers and tables as large as these
+ * frames need, so the last one should allocate nothing. One pass isn't
+ * always enough: the background mean, rounded down on each frame, takes
+ * a few passes to settle, the adaptive thresholds move with it and a
+ * frame may then find more lgcs than it did before.
+ *
+ * @param res: size, objects, density, speed, param, builtin and frames in,
+ *			   allocations and reusedObjects out
+ */
+static void checkAllocations(AllocCheck &res)
+{
+	SyntheticSource src(res.size, res.objects, res.density, 1, res.speed);
+	vector<Mat> current, background, mask;
+	Mat output(res.size, CV_8UC1);
+	MCSS fgr;
+	long long allocs;
+	int n, pass;
+
+	for( n = 0 ; n < res.frames ; ++n )
+	{
+		Mat c, b, m;
+		src.next(c, b, m);
+		current.push_back(c.clone());
+		background.push_back(b);
+		mask.push_back(m.clone());
+	}
+	fgr.setParameters(res.param);
+	res.allocations = 0;
+	res.reusedObjects = 0;
+	for( pass = 0 ; pass < CHECK_PASSES ; ++pass )
+	{
+		for( n = 0 ; n < res.frames ; ++n )
+		{
+			allocs = allocationCount();
+			if( res.builtin )
+				fgr(current[n]);
+			else
+				fgr(current[n], background[n], mask[n]);
+			fgr.getResult(output.data, output.step);
+			if( pass < CHECK_PASSES-1 )
+				continue;
+			res.allocations += allocationCount()-allocs;
+			res.reusedObjects += fgr.getStats().reusedObjects;
+		}
+	}
+	if( allocationCount() < 0 )
+		res.allocations = -1;
+}
+
+/*
+ * the scenes of --verify, each in all the four modes. The still one lets
+ * --reuse keep the lgcs of its objects, the moving ones change too much.
+ * */
+struct VerifyScene
+{
+	int width, height, objects;
+	float density, speed;
+};
+
+static const VerifyScene verifyScenes[] = {{320, 240, 4, 0.1f, OBJECT_SPEED}, {640, 480, 24, 0.25f, OBJECT_SPEED},
+	{320, 240, 6, 0.2f, 0}};
+
+struct VerifyResult
+{
+	Size size;
+	int objects;
+	float density, speed;
+	MCSS_Param param;
+	int frames;
+	/* objects that kept their lgcs, per frame */
+	double reusedObjects;
+	/* what makes this mode differ from the reference on purpose, empty if nothing */
+	string allowed;
+	/* part of the pixels classified differently from the reference */
+	double mismatch;
+	/*
+	 * against the exact classes of the generator: the part of the shadow
+	 * pixels found as shadow (detection rate) and of the object pixels
+	 * found as foreground (discrimination rate), of the model and of the
+	 * reference
+	 * */
+	double detection, discrimination, refDetection, refDiscrimination;
+	bool ok;
+};
+
+/* the counts the detection and discrimination rates come from */
+struct ShadowAccuracy
+{
+	long long shadow, shadowFound, object, objectFound;
+
+	ShadowAccuracy() : shadow(0), shadowFound(0), object(0), objectFound(0) {}
+	void add(const Mat &result, const Mat &truth);
+	double detection() const { return shadow > 0 ? (double)shadowFound/shadow : 1; }
+	double discrimination() const { return object > 0 ? (double)objectFound/object : 1; }
+};
+
+void ShadowAccuracy::add(const Mat &result, const Mat &truth)
+{
+	int i, j;
+
+	for( i = 0 ; i < truth.rows ; ++i )
+	{
+		const uchar *r = result.ptr<uchar>(i), *t = truth.ptr<uchar>(i);
+		for( j = 0 ; j < truth.cols ; ++j )
+		{
+			if( t[j] == 127 )
+			{
+				++shadow;
+				shadowFound += r[j] == 127;
+			}
+			else if( t[j] == 255 )
+			{
+				++object;
+				objectFound += r[j] == 255;
+			}
+		}
+	}
+}
+
+/**
+ * @brief allowedDifferences: the changes to the results made on purpose
+ *							  since the reference that a mode runs into
+ *
+ * Everything else the model does must give the reference's masks, the
+ * approximations the options ask for (fixed point, integer only, lgc
+ * reuse) up to --tolerance.
+ *
+ * @param p: parameters of the model
+ *
+ * @return: the names of the differences, separated by spaces, empty if none
+ */
+static string allowedDifferences(const MCSS_Param &p)
+{
+	string s;
+
+	/*
+	 * fringe_refill: the pixels the 5x5 erosion took off the mask get the
+	 * class of the nearest pixel left in it, the reference had the edge
+	 * noise correction disabled and left them background.
+	 * */
+	if( p.hasFringe )
+		s += "fringe_refill";
+	/*
+	 * pyramid: the coarse levels miss the shadows smaller than their
+	 * pixels, and the full resolution pixels around the coarse boundaries
+	 * are classified on their own luminance ratio.
+	 * */
+	if( p.pyramidLevels > 0 )
+		s += s.empty() ? "pyramid" : " pyramid";
+	return s;
+}
+
+/**
+ * @brief runVerify: run the verification scenes through the model and the
+ *					 reference side by side
+ *
+ * @param base: parameters of the model but isMGThrFixed and hasFringe
+ * @param tolerance: part of the pixels a mode without allowed differences
+ *					 may classify differently from the reference
+ * @param results: one result per scene and mode
+ */
+static void runVerify(const MCSS_Param &base, double tolerance, vector<VerifyResult> &results)
+{
+	int s, mode, n;
+
+	for( s = 0 ; s < (int)(sizeof(verifyScenes)/sizeof(verifyScenes[0])) ; ++s )
+		/* mode bit 0 is isMGThrFixed, bit 1 is hasFringe */
+		for( mode = 0 ; mode < 4 ; ++mode )
+		{
+			const VerifyScene &scene = verifyScenes[s];
+			Size size(scene.width, scene.height);
+			SyntheticSource src(size, scene.objects, scene.density, 1, scene.speed);
+			MCSSReference reference(mode & 1, mode & 2);
+			ShadowAccuracy acc, refAcc;
+			Mat current, background, mask, output, expected;
+			long long different = 0, reused = 0;
+			MCSS fgr;
+			VerifyResult res;
+
+			res.param = base;
+			res.param.isMGThrFixed = mode & 1;
+			res.param.hasFringe = mode & 2;
+			fgr.setParameters(res.param);
+			for( n = 0 ; n < VERIFY_FRAMES ; ++n )
+			{
+				src.next(current, background, mask);
+				reference(current, background, mask, expected);
+				fgr(current, background, mask, output);
+				different += countDifferent(output, expected);
+				reused += fgr.getStats().reusedObjects;
+				acc.add(output, src.getTruth());
+				refAcc.add(expected, src.getTruth());
+			}
+			res.size = size;
+			res.objects = scene.objects;
+			res.density = scene.density;
+			res.speed = scene.speed;
+			res.frames = VERIFY_FRAMES;
+			res.reusedObjects = (double)reused/VERIFY_FRAMES;
+			res.allowed = allowedDifferences(res.param);
+			res.mismatch = (double)different/((double)size.area()*VERIFY_FRAMES);
+			res.detection = acc.detection();
+			res.discrimination = acc.discrimination();
+			res.refDetection = refAcc.detection();
+			res.refDiscrimination = refAcc.discrimination();
+			if( res.allowed.empty() )
+				res.ok = res.mismatch <= tolerance;
+			else
+			{
+				double detectionLoss = 0, discriminationLoss = 0;
+
+				if( res.param.hasFringe )
+					detectionLoss = discriminationLoss = VERIFY_ACCURACY_LOSS;
+				detectionLoss += VERIFY_PYRAMID_DETECTION_LOSS*res.param.pyramidLevels;
+				discriminationLoss += VERIFY_PYRAMID_DISCRIMINATION_LOSS*res.param.pyramidLevels;
+				if( res.param.pyramidLevels > 0 && res.param.isIntegerOnly )
+					detectionLoss += VERIFY_INTEGER_PYRAMID_LOSS;
+				res.ok = res.detection >= res.refDetection-detectionLoss &&
+					res.discrimination >= res.refDiscrimination-discriminationLoss;
+			}
+			results.push_back(res);
+			cerr << "." << flush;
+		}
+	cerr << endl;
+}
+
+static const char *boolStr(bool b)
+{
+	return b ? "true" : "false";
+}
+
+static void printJSON(const vector<RunResult> &runs, const vector<CheckResult> &checks,
+		const vector<AllocCheck> &allocChecks, bool rssPerRun)
+{
+	size_t i;
+	int k;
+
+	printf("{\"kernel\": \"%s\", \"rss_per_run\": %s,\n\"runs\": [", lumRatioKernelName(), boolStr(rssPerRun));
+	for( i = 0 ; i < runs.size() ; ++i )
+	{
+		const RunResult &r = runs[i];
+		printf("%s\n  {\"source\": \"%s\", \"width\": %d, \"height\": %d, \"objects\": %d, \"density\": %g, "
+				"\"mgthr_fixed\": %s, \"fringe\": %s, \"fixed_point\": %s, \"integer_only\": %s, \"reuse_interval\": %d, \"pyramid_levels\": %d, \"builtin_background\": %s, \"output\": \"%s\", \"frames\": %d, "
+				"\"fps\": %.2f, \"mean_ms\": %.3f, \"p50_ms\": %.3f, \"p99_ms\": %.3f, \"stage_ms\": {",
+				i ? "," : "", r.source.c_str(), r.size.width, r.size.height, r.objects, r.density,
+				boolStr(r.param.isMGThrFixed), boolStr(r.param.hasFringe), boolStr(r.param.isFixedPoint),
+				boolStr(r.param.isIntegerOnly), r.param.reuseInterval, r.param.pyramidLevels, boolStr(r.builtin), encodingNames[r.encoding],
+				r.frames, r.fps, r.mean, r.p50, r.p99);
+		for( k = 0 ; k < STAGE_NUM ; ++k )
+			printf("%s\"%s\": %.3f", k ? ", " : "", stageNames[k], r.stageTime[k]);
+		printf("}, \"objects_found\": %.1f, \"lgcs\": %.1f, \"reused_objects\": %.1f, \"result_bytes\": %.0f, \"peak_labels\": %d, \"peak_rss_kb\": %ld",
+				r.objectsFound, r.lgcs, r.reusedObjects, r.resultBytes, r.peakLabels, r.peakRSS);
+		if( r.floatMismatch >= 0 )
+			printf(", \"float_mismatch\": %.6f", r.floatMismatch);
+		if( r.allocations >= 0 )
+			printf(", \"allocs_per_frame\": %.2f, \"max_allocs\": %lld", r.allocations, r.peakAllocations);
+		printf("}");
+	}
+	printf("\n],\n\"checks\": [");
+	for( i = 0 ; i < checks.size() ; ++i )
+	{
+		const CheckResult &c = checks[i];
+		printf("%s\n  {\"engine\": %s, \"instances\": %d, \"width\": %d, \"height\": %d, \"mgthr_fixed\": %s, \"fringe\": %s, "
+				"\"fixed_point\": %s, \"frames\": %d, \"fps\": %.2f, \"ok\": %s}",
+				i ? "," : "", boolStr(c.engine), c.instances, c.size.width, c.size.height, boolStr(c.param.isMGThrFixed),
+				boolStr(c.param.hasFringe), boolStr(c.param.isFixedPoint), c.frames, c.fps, boolStr(c.ok));
+	}
+	printf("\n],\n\"alloc_checks\": [");
+	for( i = 0 ; i < allocChecks.size() ; ++i )
+	{
+		const AllocCheck &a = allocChecks[i];
+		printf("%s\n  {\"width\": %d, \"height\": %d, \"objects\": %d, \"density\": %g, \"speed\": %g, \"mgthr_fixed\": %s, "
+				"\"fringe\": %s, \"fixed_point\": %s, \"integer_only\": %s, \"reuse_interval\": %d, \"pyramid_levels\": %d, "
+				"\"builtin_background\": %s, \"frames\": %d, \"reused_objects\": %d, \"allocations\": %lld, \"ok\": %s}",
+				i ? "," : "", a.size.width, a.size.height, a.objects, a.density, a.speed, boolStr(a.param.isMGThrFixed),
+				boolStr(a.param.hasFringe), boolStr(a.param.isFixedPoint), boolStr(a.param.isIntegerOnly),
+				a.param.reuseInterval, a.param.pyramidLevels, boolStr(a.builtin), a.frames, a.reusedObjects,
+				a.allocations, boolStr(a.allocations == 0));
+	}
+	printf("\n]}\n");
+}
+
+static void printCSV(const vector<RunResult> &runs, const vector<CheckResult> &checks,
+		const vector<AllocCheck> &allocChecks)
+{
+	size_t i;
+	int k;
+
+	printf("source,width,height,objects,density,mgthr_fixed,fringe,fixed_point,integer_only,reuse_interval,pyramid_levels,builtin_background,output,frames,fps,mean_ms,p50_ms,p99_ms");
+	for( k = 0 ; k < STAGE_NUM ; ++k )
+		printf(",%s_ms", stageNames[k]);
+	printf(",objects_found,lgcs,reused_objects,result_bytes,peak_labels,peak_rss_kb,float_mismatch,allocs_per_frame,max_allocs\n");
+	for( i = 0 ; i < runs.size() ; ++i )
+	{
+		const RunResult &r = runs[i];
+		printf("%s,%d,%d,%d,%g,%d,%d,%d,%d,%d,%d,%d,%s,%d,%.2f,%.3f,%.3f,%.3f", r.source.c_str(),
+				r.size.width, r.size.height, r.objects, r.density, r.param.isMGThrFixed,
+				r.param.hasFringe, r.param.isFixedPoint, r.param.isIntegerOnly, r.param.reuseInterval,
+				r.param.pyramidLevels, r.builtin, encodingNames[r.encoding], r.frames, r.fps, r.mean, r.p50, r.p99);
+		for( k = 0 ; k < STAGE_NUM ; ++k )
+			printf(",%.3f", r.stageTime[k]);
+		printf(",%.1f,%.1f,%.1f,%.0f,%d,%ld,", r.objectsFound, r.lgcs, r.reusedObjects, r.resultBytes, r.peakLabels, r.peakRSS);
+		/* empty when not compared */
+		if( r.floatMismatch >= 0 )
+			printf("%.6f", r.floatMismatch);
+		printf(",");
+		if( r.allocations >= 0 )
+			printf("%.2f,%lld", r.allocations, r.peakAllocations);
+		else
+			printf(",");
+		printf("\n");
+	}
+	/* a second table would break the csv, the checks go to the log */
+	for( i = 0 ; i < checks.size() ; ++i )
+	{
+		const CheckResult &c = checks[i];
+		fprintf(stderr, "check %d %s %dx%d mgthr_fixed=%d fringe=%d: %.2f fps, %s\n",
+				c.instances, c.engine ? "engine streams" : "instances", c.size.width, c.size.height, c.param.isMGThrFixed, c.param.hasFringe,
+				c.fps, c.ok ? "ok" : "MISMATCH");
+	}
+	for( i = 0 ; i < allocChecks.size() ; ++i )
+	{
+		const AllocCheck &a = allocChecks[i];
+		fprintf(stderr, "allocations %dx%d objects=%d density=%g speed=%g mgthr_fixed=%d fringe=%d pyramid=%d reused=%d: %lld\n",
+				a.size.width, a.size.height, a.objects, a.density, a.speed, a.param.isMGThrFixed, a.param.hasFringe,
+				a.param.pyramidLevels, a.reusedObjects, a.allocations);
+	}
+}
+
+static void printVerify(const vector<VerifyResult> &results, bool csv, double tolerance)
+{
+	size_t i;
+
+	if( csv )
+		printf("width,height,objects,density,speed,mgthr_fixed,fringe,fixed_point,integer_only,reuse_interval,pyramid_levels,frames,"
+				"reused_objects,allowed_differences,mismatch,shadow_detection,shadow_discrimination,ref_shadow_detection,ref_shadow_discrimination,ok\n");
+	else
+		printf("{\"kernel\": \"%s\", \"tolerance\": %g, \"accuracy_loss\": %g, \"pyramid_detection_loss\": %g, "
+				"\"pyramid_discrimination_loss\": %g, \"integer_pyramid_loss\": %g,\n\"verify\": [", lumRatioKernelName(), tolerance,
+				VERIFY_ACCURACY_LOSS, VERIFY_PYRAMID_DETECTION_LOSS, VERIFY_PYRAMID_DISCRIMINATION_LOSS, VERIFY_INTEGER_PYRAMID_LOSS);
+	for( i = 0 ; i < results.size() ; ++i )
+	{
+		const VerifyResult &r = results[i];
+		if( csv )
+			printf("%d,%d,%d,%g,%g,%d,%d,%d,%d,%d,%d,%d,%.1f,%s,%.6f,%.4f,%.4f,%.4f,%.4f,%d\n", r.size.width, r.size.height,
+					r.objects, r.density, r.speed, r.param.isMGThrFixed, r.param.hasFringe, r.param.isFixedPoint,
+					r.param.isIntegerOnly, r.param.reuseInterval, r.param.pyramidLevels, r.frames, r.reusedObjects, r.allowed.c_str(),
+					r.mismatch, r.detection, r.discrimination, r.refDetection, r.refDiscrimination, r.ok);
+		else
+			printf("%s\n  {\"width\": %d, \"height\": %d, \"objects\": %d, \"density\": %g, \"speed\": %g, \"mgthr_fixed\": %s, "
+					"\"fringe\": %s, \"fixed_point\": %s, \"integer_only\": %s, \"reuse_interval\": %d, \"pyramid_levels\": %d, "
+					"\"frames\": %d, \"reused_objects\": %.1f, \"allowed_differences\": \"%s\", \"mismatch\": %.6f, \"shadow_detection\": %.4f, "
+					"\"shadow_discrimination\": %.4f, \"ref_shadow_detection\": %.4f, \"ref_shadow_discrimination\": %.4f, \"ok\": %s}",
+					i ? "," : "", r.size.width, r.size.height, r.objects, r.density, r.speed, boolStr(r.param.isMGThrFixed),
+					boolStr(r.param.hasFringe), boolStr(r.param.isFixedPoint), boolStr(r.param.isIntegerOnly),
+					r.param.reuseInterval, r.param.pyramidLevels, r.frames, r.reusedObjects, r.allowed.c_str(), r.mismatch, r.detection,
+					r.discrimination, r.refDetection, r.refDiscrimination, boolStr(r.ok));
+	}
+	if( !csv )
+		printf("\n]}\n");
+}
+
+static bool parseSizes(const char *s, vector<Size> &sizes)
+{
+	int w, h, n;
+
+	sizes.clear();
+	while( sscanf(s, "%dx%d%n", &w, &h, &n) == 2 && w > 0 && h > 0 )
+	{
+		sizes.push_back(Size(w, h));
+		s += n;
+		if( *s != ',' )
+			break;
+		++s;
+	}
+	return *s == '\0' && !sizes.empty();
+}
+
+template<typename T>
+static bool parseList(const char *s, vector<T> &list)
+{
+	double x;
+	int n;
+
+	list.clear();
+	while( sscanf(s, "%lf%n", &x, &n) == 1 && x >= 0 )
+	{
+		list.push_back((T)x);
+		s += n;
+		if( *s != ',' )
+			break;
+		++s;
+	}
+	return *s == '\0' && !list.empty();
+}
+
+static void usage(const char *name)
+{
+	cerr << "Usage: " << name << " [options]" << endl
+		<< "  --sizes WxH,...          sizes of the synthetic frames (320x240,640x480,1280x720,1920x1080)" << endl
+		<< "  --objects N,...          objects in the synthetic frames (1,8,32,256)" << endl
+		<< "  --density F,...          part of the frame covered by objects and shadows (0.05,0.2)" << endl
+		<< "  --input video mask bg    time these videos instead of synthetic frames" << endl
+		<< "  --frames N               timed frames of each run (" << BENCH_FRAMES << ")" << endl
+		<< "  --warmup N               frames run before the timing starts (" << BENCH_WARMUP << ")" << endl
+		<< "  --fixed-point            compute the luminance ratio in fixed point" << endl
+		<< "  --integer                run on integers only and compare the masks with a float model" << endl
+		<< "  --reuse K                let slowly moving objects keep their LGCs for up to K frames" << endl
+		<< "  --pyramid L              run on the frames halved L times and refine the result" << endl
+		<< "  --builtin-background     give the model the frame alone, it makes its own background and mask" << endl
+		<< "  --output dense|packed|runs  read the result as 8-bit, 2-bit codes or runs of each row (dense)" << endl
+		<< "  --check N                also check N models running on their own threads," << endl
+		<< "                           and N streams of one MCSSEngine" << endl
+		<< "  --zero-alloc             also check that a model allocates nothing on frames it has seen" << endl
+		<< "  --verify                 compare the masks of the verification scenes with the frozen reference model" << endl
+		<< "  --tolerance F            part of the pixels --verify lets differ where nothing is allowed to (0)" << endl
+		<< "  --format json|csv        output format (json)" << endl;
+}
+
+int main(int argc, char *argv[])
+{
+	vector<Size> sizes;
+	vector<int> objects;
+	vector<float> densities;
+	vector<RunResult> runs;
+	vector<CheckResult> checks;
+	vector<AllocCheck> allocChecks;
+	const char *video = NULL, *mask = NULL, *background = NULL;
+	int frames = BENCH_FRAMES, warmup = BENCH_WARMUP, instances = 0, reuseInterval = 0, pyramidLevels = 0;
+	bool csv = false, fixedPoint = false, integerOnly = false, builtin = false, verify = false, zeroAlloc = false;
+	bool rssPerRun, ok = true;
+	double tolerance = 0;
+	ResultEncoding encoding = ENCODING_DENSE;
+	size_t i, j, k;
+	int mode, speed, pyramid;
+
+	parseSizes("320x240,640x480,1280x720,1920x1080", sizes);
+	parseList("1,8,32,256", objects);
+	parseList("0.05,0.2", densities);
+	for( mode = 1 ; mode < argc ; ++mode )
+	{
+		string arg = argv[mode];
+		bool hasValue = mode+1 < argc;
+		if( arg == "--sizes" && hasValue )
+			ok = parseSizes(argv[++mode], sizes);
+		else if( arg == "--objects" && hasValue )
+			ok = parseList(argv[++mode], objects);
+		else if( arg == "--density" && hasValue )
+			ok = parseList(argv[++mode], densities);
+		else if( arg == "--input" && mode+3 < argc )
+		{
+			video = argv[++mode];
+			mask = argv[++mode];
+			background = argv[++mode];
+		}
+		else if( arg == "--frames" && hasValue )
+			ok = (frames = atoi(argv[++mode])) > 0;
+		else if( arg == "--warmup" && hasValue )
+			ok = (warmup = atoi(argv[++mode])) >= 0;
+		else if( arg == "--fixed-point" )
+			fixedPoint = true;
+		else if( arg == "--integer" )
+			integerOnly = true;
+		else if( arg == "--reuse" && hasValue )
+			ok = (reuseInterval = atoi(argv[++mode])) >= 0;
+		else if( arg == "--pyramid" && hasValue )
+			ok = (pyramidLevels = atoi(argv[++mode])) >= 0;
+		else if( arg == "--builtin-background" )
+			builtin = true;
+		else if( arg == "--output" && hasValue )
+		{
+			arg = argv[++mode];
+			encoding = arg == "packed" ? ENCODING_PACKED : arg == "runs" ? ENCODING_RUNS : ENCODING_DENSE;
+			ok = encoding != ENCODING_DENSE || arg == "dense";
+		}
+		else if( arg == "--check" && hasValue )
+			ok = (instances = atoi(argv[++mode])) > 0;
+		else if( arg == "--zero-alloc" )
+			zeroAlloc = true;
+		else if( arg == "--verify" )
+			verify = true;
+		else if( arg == "--tolerance" && hasValue )
+			ok = (tolerance = atof(argv[++mode])) >= 0;
+		else if( arg == "--format" && hasValue )
+		{
+			arg = argv[++mode];
+			csv = arg == "csv";
+			ok = csv || arg == "json";
+		}
+		else
+			ok = false;
+		if( !ok )
+		{
+			usage(argv[0]);
+			return -1;
+		}
+	}
+
+	if( verify )
+	{
+		vector<VerifyResult> results;
+		runVerify(makeParam(false, false, fixedPoint, integerOnly, reuseInterval, pyramidLevels), tolerance, results);
+		printVerify(results, csv, tolerance);
+		for( i = 0 ; i < results.size() ; ++i )
+			ok = ok && results[i].ok;
+		return ok ? 0 : 1;
+	}
+
+	rssPerRun = resetPeakRSS();
+	/* mode bit 0 is isMGThrFixed, bit 1 is hasFringe */
+	for( mode = 0 ; mode < 4 ; ++mode )
+	{
+		MCSS_Param p = makeParam(mode & 1, mode & 2, fixedPoint, integerOnly, reuseInterval, pyramidLevels);
+		if( video != NULL )
+		{
+			VideoSource src(video, mask, background);
+			if( !src.isOpened() )
+			{
+				cerr << "Can not open " << video << ", " << mask << " or " << background << endl;
+				return -1;
+			}
+			RunResult res;
+			res.source = video;
+			res.objects = 0;
+			res.density = 0;
+			runBench(src, p, builtin, encoding, warmup, frames, res);
+			runs.push_back(res);
+			continue;
+		}
+		for( i = 0 ; i < sizes.size() ; ++i )
+			for( j = 0 ; j < objects.size() ; ++j )
+				for( k = 0 ; k < densities.size() ; ++k )
+				{
+					SyntheticSource src(sizes[i], objects[j], densities[k]);
+					RunResult res;
+					res.source = "synthetic";
+					res.size = sizes[i];
+					res.objects = objects[j];
+					res.density = densities[k];
+					runBench(src, p, builtin, encoding, warmup, frames, res);
+					runs.push_back(res);
+					cerr << "." << flush;
+				}
+		if( instances > 0 )
+		{
+			CheckResult res;
+			res.engine = false;
+			res.instances = instances;
+			res.size = sizes[0];
+			res.param = p;
+			res.frames = CHECK_FRAMES;
+			checkConcurrent(res, objects[0], densities[0]);
+			ok = ok && res.ok;
+			checks.push_back(res);
+			res.engine = true;
+			checkEngine(res, objects[0], densities[0]);
+			ok = ok && res.ok;
+			checks.push_back(res);
+		}
+		/*
+		 * the moving objects never keep their lgcs, with --reuse still ones
+		 * are checked too. Without --pyramid the model is checked with one
+		 * pyramid level as well.
+		 * */
+		for( i = 0 ; zeroAlloc && i < sizes.size() ; ++i )
+			for( j = 0 ; j < objects.size() ; ++j )
+				for( k = 0 ; k < densities.size() ; ++k )
+					for( speed = 0 ; speed < (p.reuseInterval > 0 ? 2 : 1) ; ++speed )
+						for( pyramid = 0 ; pyramid < (p.pyramidLevels > 0 ? 1 : 2) ; ++pyramid )
+						{
+							AllocCheck res;
+							res.size = sizes[i];
+							res.objects = objects[j];
+							res.density = densities[k];
+							res.speed = speed ? 0 : OBJECT_SPEED;
+							res.param = p;
+							if( pyramid )
+								res.param.pyramidLevels = 1;
+							res.builtin = builtin;
+							res.frames = CHECK_FRAMES;
+							checkAllocations(res);
+							ok = ok && res.allocations == 0;
+							allocChecks.push_back(res);
+						}
+	}
+	cerr << endl;
+	if( csv )
+		printCSV(runs, checks, allocChecks);
+	else
+		printJSON(runs, checks, allocChecks, rssPerRun);
+
+	return ok ? 0 : 1;
+}
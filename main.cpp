@@ -1,14 +1,29 @@
 #include  "MCSS.h"
+#include  "MCSSDiagnostics.h"
+#include  "DecodeStage.h"
 #include  <opencv2/opencv.hpp>
 
 using namespace cv;
 
+/* number of frames a stage may run ahead of the next one */
+#define  PIPELINE_DEPTH	4
+/* the background video is only read for the first frames */
+#define  BACKGROUND_FRAMES	9
+
+/* everything the output stage shows of one frame */
+struct Result
+{
+	Mat frame, mask, bg, dst;
+};
+
+typedef SPSCQueue<Result> ResultQueue;
+
 void lgcLabel_mouse_call_back(int event, int x, int y, int flags, void* userdata)
 {
 	Mat *mat = (Mat *)userdata;
-	if( event == CV_EVENT_LBUTTONDOWN )
+	if( event == CV_EVENT_LBUTTONDOWN && mat->data )
 	{
-		int label = *mat->ptr(y, x)-1;
+		int label = mat->at<int>(y, x)-1;
 		cerr << "(" << x << " " << y << ") Label = " << label << endl;
 	}
 }
@@ -17,7 +32,7 @@ void lumRatio_mouse_call_back(int event, int x, int y, int flags, void* userdata
 {
 	Mat *mat = (Mat *)userdata;
 	float b, g, r;
-	if( event == CV_EVENT_LBUTTONDOWN )
+	if( event == CV_EVENT_LBUTTONDOWN && mat->data )
 	{
 		b = mat->at<Vec3f>(y, x)[0];
 		g = mat->at<Vec3f>(y, x)[1];
@@ -26,18 +41,119 @@ void lumRatio_mouse_call_back(int event, int x, int y, int flags, void* userdata
 	}
 }
 
+/**
+ * @brief processLoop: processing stage, runs the model on the decoded frames
+ *
+ * @param fgr: the model
+ * @param video: queue of the video frames
+ * @param masks: queue of the foreground masks, NULL to use the built-in background model
+ * @param backgrounds: queue of the background images
+ * @param results: queue to the output stage
+ * @param stop: raised when the pipeline shuts down
+ */
+void processLoop(MCSS *fgr, FrameQueue *video, FrameQueue *masks, FrameQueue *backgrounds,
+		ResultQueue *results, std::atomic<bool> *stop)
+{
+	Mat bg;
+	bool hasBackground = true;
+
+	while( 1 )
+	{
+		Result res;
+		if( !video->pop(res.frame, *stop) || !res.frame.data )
+			break;
+		if( masks == NULL )
+		{
+			(*fgr)(res.frame, res.dst);
+			/* the model reuses its buffers, the output stage gets copies */
+			res.mask = fgr->fgMask.clone();
+			res.bg = fgr->bgImage.clone();
+			if( !results->push(res, *stop) )
+				return;
+			continue;
+		}
+		if( !masks->pop(res.mask, *stop) || !res.mask.data )
+			break;
+		if( hasBackground )
+		{
+			Mat tmp;
+			if( !backgrounds->pop(tmp, *stop) )
+				break;
+			/* keep the last background once its input is over */
+			if( tmp.data )
+				bg = tmp;
+			else
+				hasBackground = false;
+		}
+		res.bg = bg;
+
+		(*fgr)(res.frame, res.bg, res.mask, res.dst);
+		if( !results->push(res, *stop) )
+			return;
+	}
+	results->push(Result(), *stop);
+}
+
+/**
+ * @brief drawLGC: paint each lgc region with its own color
+ *
+ * @param lgcLabel: lgc label of each pixel
+ * @param img: the picture, small regions are white
+ */
+void drawLGC(const Mat &lgcLabel, Mat &img)
+{
+	int i, j;
+
+	img.create(lgcLabel.size(), CV_8UC3);
+	for( i = 0 ; i < lgcLabel.rows ; ++i )
+	{
+		const int *label = lgcLabel.ptr<int>(i);
+		Vec3b *p = img.ptr<Vec3b>(i);
+		for( j = 0 ; j < lgcLabel.cols ; ++j )
+		{
+			if( label[j] == 0 )
+				p[j] = Vec3b(0, 0, 0);
+			else if( label[j] == SMALL_LGC_LABEL )
+				p[j] = Vec3b(255, 255, 255);
+			else
+				p[j] = Vec3b(label[j]%5*50+50, 205-label[j]%5*50, label[j]%5*50+50);
+		}
+	}
+}
+
+/**
+ * @brief printDiagnostics: log the thresholds and the lgc table of a frame
+ */
+void printDiagnostics(const MCSS_DiagFrame &d)
+{
+	size_t i;
+
+	cerr << endl << "frame " << d.frame << endl;
+	for( i = 0 ; i < d.mgThr.size() ; ++i )
+		cerr << "mgThr[" << i << "] = " << d.mgThr[i][0] << " " << d.mgThr[i][1] << " " << d.mgThr[i][2] << endl;
+	cerr << "Get " << d.lgcs.size() << " lgc regions" << endl;
+	for( i = 0 ; i < d.lgcs.size() ; ++i )
+	{
+		const MCSS_LGCInfo &l = d.lgcs[i];
+		cerr << "meanLGC[" << i << "] = [" << l.mean[0] << " " << l.mean[1] << " " << l.mean[2] << "]"
+			<< " tpw[" << i << "] = " << l.tpw << "(external, all)" << l.external << " " << l.all
+			<< " lgcArea = " << l.area << " shadow = " << l.isShadow << endl;
+	}
+}
+
 int main(int argc, char *argv[])
 {
-	Mat frame, bg, mask, dst, tmp;
+	Mat frame, tmp, lumRatio, lgcLabel, lgcImg;
 	VideoCapture cap, cap2, cap3;
 	MCSS fgr;
+	MCSSDiagnostics diag;
 	MCSS_Param p;
-	int n = 0, key;
-	bool resizeFrame = false;
+	int key, levels = 0;
 
-	if( argc != 4 )
+	if( argc != 2 && argc != 4 )
 	{
-		cerr << "Usage: " << argv[0] << " <video-path> <mask-path> <bg-path>" << endl;
+		cerr << "Usage: " << argv[0] << " <video-path> [<mask-path> <bg-path>]" << endl;
+		cerr << "  without the mask and the background the model makes its own" << endl;
 		return -1;
 	}
 
@@ -53,39 +169,44 @@ int main(int argc, char *argv[])
 		cout << "can not read data from " << argv[1] << endl;
 		return -1;
 	}
-	if( frame.cols*frame.rows > 600*600 )
-		resizeFrame = true;
+	/* big frames run in pyramid mode, the model refines its coarse result to full resolution */
+	while( (frame.cols >> levels)*(frame.rows >> levels) > 600*600 )
+		++levels;
 
-	cap2.open(std::string(argv[2]));
-	if( !cap2.isOpened() )
+	if( argc == 4 )
 	{
-		cout << endl << "Can not open " << argv[2] << endl;
-		return -1;
-	}
-	cap2 >> tmp;
-	if(!tmp.data)
-	{
-		cout << "can not read data from " << argv[2] << endl;
-		return -1;
-	}
+		cap2.open(std::string(argv[2]));
+		if( !cap2.isOpened() )
+		{
+			cout << endl << "Can not open " << argv[2] << endl;
+			return -1;
+		}
+		cap2 >> tmp;
+		if(!tmp.data)
+		{
+			cout << "can not read data from " << argv[2] << endl;
+			return -1;
+		}
 
-	cap3.open(std::string(argv[3]));
-	if( !cap3.isOpened() )
-	{
-		cout << endl << "Can not open " << argv[3] << endl;
-		return -1;
-	}
-	cap3 >> tmp;
-	if(!tmp.data)
-	{
-		cout << "can not read data from " << argv[3] << endl;
-		return -1;
+		cap3.open(std::string(argv[3]));
+		if( !cap3.isOpened() )
+		{
+			cout << endl << "Can not open " << argv[3] << endl;
+			return -1;
+		}
+		cap3 >> tmp;
+		if(!tmp.data)
+		{
+			cout << "can not read data from " << argv[3] << endl;
+			return -1;
+		}
 	}
 
 	namedWindow("lumRatio");
 	namedWindow("lgcImg");
-	setMouseCallback("lumRatio", lumRatio_mouse_call_back, &fgr.lumRatio);
-	setMouseCallback("lgcImg", lgcLabel_mouse_call_back, &fgr.lgcLabel);
+	/* the callbacks run in waitKey, on this thread, so they read our own copies */
+	setMouseCallback("lumRatio", lumRatio_mouse_call_back, &lumRatio);
+	setMouseCallback("lgcImg", lgcLabel_mouse_call_back, &lgcLabel);
 
 	p = fgr.getParameters();
 	p.alpha = 0.000621;
@@ -94,50 +215,94 @@ int main(int argc, char *argv[])
 	p.isMGThrFixed = true;
 	p.hasFringe = true;
 	p.mgThrFixed = Vec3f(0.23, 0.23, 0.23);
+	p.pyramidLevels = levels;
 	// p.alpha = 0.00021;
 	fgr.setParameters(p);
-	while( (key = waitKey(30)) != 27 )
+	/* the model only copies its intermediate results out, they are shown and logged here */
+	fgr.setDiagnostics(&diag);
+
+	/* 
+	 * decode -> process -> output pipeline, each input is decoded by its own
+	 * thread, the model runs on another one and this thread shows the results
+	 * (HighGUI wants a single thread). The bounded queues hold back a stage
+	 * that runs ahead, so the slowest stage sets the pace. With the video
+	 * alone only that one is decoded.
+	 * */
+	bool hasMask = argc == 4;
+	std::atomic<bool> stop(false);
+	FrameQueue videoQueue(PIPELINE_DEPTH), maskQueue(PIPELINE_DEPTH), bgQueue(PIPELINE_DEPTH);
+	ResultQueue resultQueue(PIPELINE_DEPTH);
+	std::thread videoThread(decodeLoop, &cap, INPUT_VIDEO, 0, &videoQueue, &stop);
+	std::thread maskThread, bgThread;
+	if( hasMask )
 	{
-		n++;
-		if( key == ' ' )
-			while( (key = waitKey(0)) != ' ' );
-		cap >> frame;
-		if( !frame.data )
-			break;
+		maskThread = std::thread(decodeLoop, &cap2, INPUT_MASK, 0, &maskQueue, &stop);
+		bgThread = std::thread(decodeLoop, &cap3, INPUT_BACKGROUND, BACKGROUND_FRAMES, &bgQueue, &stop);
+	}
+	std::thread processThread(processLoop, &fgr, &videoQueue, hasMask ? &maskQueue : NULL, &bgQueue,
+			&resultQueue, &stop);
 
-		cap2 >> tmp;
-		cvtColor(tmp, mask, CV_BGR2GRAY);
-		threshold(mask, mask, 128, 255, CV_THRESH_BINARY);
-		if( n < 10 )
+	while( 1 )
+	{
+		Result res;
+		if( !resultQueue.tryPop(res) )
 		{
-			cap3 >> bg;
-			// resize(bg, bg, tmp.size(), 1, 0);
+			/* keep the windows alive while the pipeline fills up */
+			if( waitKey(1) == 27 )
+				break;
+			continue;
 		}
-		// bg = imread(argv[3]);
+		if( !res.frame.data )
+			break;
 
-		if( resizeFrame )
+		imshow("image", res.frame);
+		imshow("mask", res.mask);
+		imshow("background", res.bg);
+		// threshold(res.dst, res.dst, 128, 255, CV_THRESH_BINARY);
+		imshow("dst", res.dst);
+		/* 
+		 * the model has published this frame before its result, show the
+		 * latest diagnostics, some may have been dropped while we were slow
+		 * */
+		const MCSS_DiagFrame *d;
+		bool hasDiag = false;
+		while( (d = diag.beginRead()) != NULL )
 		{
-			resize(frame, frame, Size(frame.cols/2, frame.rows/2));
-			resize(mask, mask, frame.size());
-			resize(bg, bg, frame.size());
+			printDiagnostics(*d);
+			d->lumRatio.copyTo(lumRatio);
+			d->lgcLabel.copyTo(lgcLabel);
+			diag.endRead();
+			hasDiag = true;
+		}
+		if( hasDiag )
+		{
+			lumRatio.convertTo(tmp, CV_8UC3, 30, 0);
+			imshow("lumRatio", tmp);
+			drawLGC(lgcLabel, lgcImg);
+			imshow("lgcImg", lgcImg);
 		}
-
-		imshow("image", frame);
-		imshow("mask", mask);
-		imshow("background", bg);
-		fgr(frame, bg, mask, dst);
-		// threshold(dst, dst, 128, 255, CV_THRESH_BINARY);
-		fgr.lumRatio.convertTo(tmp, CV_8UC3, 30, 0);
-		imshow("dst", dst);
-		imshow("lumRatio", tmp);
 
 #if 0
 		stringstream stream;
 		stream << "pic/pic_" << n++ << ".jpg";
-		imwrite(stream.str(), dst);
+		imwrite(stream.str(), res.dst);
 #endif
+
+		key = waitKey(1);
+		if( key == 27 )
+			break;
+		if( key == ' ' )
+			while( (key = waitKey(0)) != ' ' );
 	}
 
+	stop = true;
+	videoThread.join();
+	if( hasMask )
+	{
+		maskThread.join();
+		bgThread.join();
+	}
+	processThread.join();
+
 	return 0;
 }
-